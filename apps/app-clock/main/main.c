@@ -85,6 +85,7 @@ SOME EXTRA FUNCTIONS for easy working with the epaper
         .color_inv = 1,
 
         .fast_bw_mode = true,
+        .bw_only = true,
     };
 
     //For slow full color mode
@@ -113,35 +114,29 @@ SOME EXTRA FUNCTIONS for easy working with the epaper
         .fast_bw_mode = false,
     };
 
-epaper_handle_t global_fast_epaper = NULL;
-epaper_handle_t global_full_epaper = NULL;
+epaper_handle_t global_epaper = NULL;
 
+//The device is created once, later calls only switch the panel mode
 epaper_handle_t init_fast_epaper () {
-     if (global_full_epaper != NULL) {
-        iot_epaper_delete(global_full_epaper, true);
-        global_full_epaper = NULL;
-    }
-
-    if (global_fast_epaper == NULL) {
-        global_fast_epaper = iot_epaper_create(NULL, &epaper_conf_fastbw);
-        iot_epaper_set_rotate(global_fast_epaper, E_PAPER_ROTATE_90);
+    if (global_epaper == NULL) {
+        global_epaper = iot_epaper_create(NULL, &epaper_conf_fastbw);
+        iot_epaper_set_rotate(global_epaper, E_PAPER_ROTATE_90);
+    } else {
+        iot_epaper_set_mode(global_epaper, true);
     }
 
-    return global_fast_epaper;
+    return global_epaper;
 }
 
 epaper_handle_t init_full_epaper () {
-    if (global_fast_epaper != NULL) {
-        iot_epaper_delete(global_fast_epaper, true);
-        global_fast_epaper = NULL;
-    }
-
-    if (global_full_epaper == NULL) {
-        global_full_epaper = iot_epaper_create(NULL, &epaper_conf_slowbwr);
-        iot_epaper_set_rotate(global_full_epaper, E_PAPER_ROTATE_90);
+    if (global_epaper == NULL) {
+        global_epaper = iot_epaper_create(NULL, &epaper_conf_slowbwr);
+        iot_epaper_set_rotate(global_epaper, E_PAPER_ROTATE_90);
+    } else {
+        iot_epaper_set_mode(global_epaper, false);
     }
 
-    return global_full_epaper;
+    return global_epaper;
 }
 
 void clear_screen() {
@@ -313,8 +308,9 @@ void app_main(void)
     message[2]="Reading settings from SD card...";   
     message_box(message, 3);
 
-    iot_epaper_delete(global_fast_epaper, true);
-    global_fast_epaper = NULL;
+    //The SD card shares the SPI pins, so the ePaper device goes away for now
+    iot_epaper_delete(global_epaper, true);
+    global_epaper = NULL;
     
     //Get settings from SD
     //SETTINGS OF MOUNTING
@@ -460,6 +456,10 @@ void app_main(void)
     char *day_text[7] = {"MON", "TUE", "WED", "THUR", "FRI", "SAT", "SUN"};
     char day_mon_year_text[30];    
 
+    //From here on the display service does the refreshes, the loop only draws and submits
+    epaper_handle_t clock_epaper = init_full_epaper();
+    Error_Check_Msg(iot_epaper_service_start(clock_epaper), "display service failed");
+
     //Main loop to show time on the epaper display
     while(1){
         time(&now);
@@ -467,8 +467,15 @@ void app_main(void)
 
         //Full update every minute to avoid permanently destroying the display 
         if (min != timeinfo.tm_min) {
-        
-            epaper_handle_t full_epaper = init_full_epaper();
+            epaper_handle_t full_epaper = clock_epaper;
+            epaper_stats_t stats;
+
+            //One line a minute to graph the refresh behaviour from the log
+            iot_epaper_get_stats(full_epaper, &stats);
+            ESP_LOGI(TAG, "refreshes %u full %u fast, last %u ms, SPI %llu bytes, render %llu ms, busy %llu ms",
+                    stats.full_refreshes, stats.fast_refreshes, stats.last_refresh_us / 1000,
+                    (unsigned long long) stats.spi_bytes, (unsigned long long) stats.render_us / 1000,
+                    (unsigned long long) stats.wait_idle_us / 1000);
 
             iot_epaper_clean_paint(full_epaper, WHITE);	//clean the whole screen with WHITE			    
 
@@ -483,20 +490,24 @@ void app_main(void)
             iot_epaper_draw_string(full_epaper, 100, 40, min_text, &epaper_font_60, RED); 
             iot_epaper_draw_string(full_epaper, 175, 25, ":", &epaper_font_60, RED); 
 
-            iot_epaper_display_frame(full_epaper);
+            iot_epaper_submit_frame(full_epaper, false);
         } 
         
         //We use else if here so timeinfo will be updated again before we print the sec
         else if (sec != timeinfo.tm_sec) {        
-            epaper_handle_t fast_epaper = init_fast_epaper ();
+            epaper_handle_t fast_epaper = clock_epaper;
             iot_epaper_clean_paint(fast_epaper, WHITE);
             sprintf(sec_text, "%02d", timeinfo.tm_sec);            
             iot_epaper_draw_string(fast_epaper, 200, 40, sec_text, &epaper_font_60, BLACK);
-            iot_epaper_display_frame(fast_epaper);
+            //Only the seconds change, so only push their window to the display
+            iot_epaper_submit_region(fast_epaper, 200, 40, 200 + 2 * epaper_font_60.width - 1, 40 + epaper_font_60.height - 1, true);
         }
         
         min = timeinfo.tm_min;
         sec  = timeinfo.tm_sec;
+
+        //Submitting does not wait for the refresh, so give the other tasks some time
+        vTaskDelay(100 / portTICK_PERIOD_MS);
     }
     
  
@@ -31,33 +31,7 @@ void e_paper_task(void *pvParameter)
 {
     epaper_handle_t device = NULL;
 
-    //For fast bw mode
-    epaper_conf_t epaper_conf_fastbw = {
-        .busy_pin = BUSY_PIN,
-        .cs_pin = CS_PIN,
-        .dc_pin = DC_PIN,
-        .miso_pin = MISO_PIN,
-        .mosi_pin = MOSI_PIN,
-        .reset_pin = RST_PIN,
-        .sck_pin = SCK_PIN,
-
-        .rst_active_level = 0,
-        .busy_active_level = 1,
-
-        .dc_lev_data = 1,
-        .dc_lev_cmd = 0,
-
-        .clk_freq_hz = 20 * 1000 * 1000,
-        .spi_host = HSPI_HOST,
-
-        .width = EPD_WIDTH,
-        .height = EPD_HEIGHT,
-        .color_inv = 1,
-
-        .fast_bw_mode = true,
-    };
-
-    //For slow full color mode
+    //Created in full color mode, iot_epaper_set_mode() switches to fast bw mode
     epaper_conf_t epaper_conf_slowbwr = {
         .busy_pin = BUSY_PIN,
         .cs_pin = CS_PIN,
@@ -92,15 +66,17 @@ void e_paper_task(void *pvParameter)
     char count_str[12];
 
     int TIME_TO_FULL_REFRESH = 60;
-    fast_refresh_count = TIME_TO_FULL_REFRESH; // This is to force a proper clean in the beginning.
     while(1){
         
-		if (fast_refresh_count  == TIME_TO_FULL_REFRESH) {
-            if (device != NULL) {
-                iot_epaper_delete(device, true); 
-            }          
-            device = iot_epaper_create(NULL, &epaper_conf_slowbwr);
-            iot_epaper_set_rotate(device, E_PAPER_ROTATE_90);
+        //The driver counts the fast refreshes, a proper clean is also forced in the beginning.
+		if (device == NULL || iot_epaper_full_refresh_due(device)) {
+            if (device == NULL) {
+                device = iot_epaper_create(NULL, &epaper_conf_slowbwr);
+                iot_epaper_set_rotate(device, E_PAPER_ROTATE_90);
+                iot_epaper_set_ghosting_budget(device, TIME_TO_FULL_REFRESH, false);
+            } else {
+                iot_epaper_set_mode(device, false);
+            }
            
 
             iot_epaper_clean_paint(device, WHITE);	//clean the whole screen with WHITE			
@@ -116,16 +92,12 @@ void e_paper_task(void *pvParameter)
 
            
             fast_refresh_count = 0;
-            iot_epaper_delete(device, true);
-            device = NULL;
 
             vTaskDelay(5000 / portTICK_PERIOD_MS); //Delay for 5 seconds to show the display with RED prints.
            
         } else {
-            if  (device == NULL) {
-                device = iot_epaper_create(NULL, &epaper_conf_fastbw);
-                iot_epaper_set_rotate(device, E_PAPER_ROTATE_90);
-            }
+            //Same device, only the panel mode changes
+            iot_epaper_set_mode(device, true);
 
             memset(count_str, 0x00, sizeof(count_str));          
             sprintf(count_str, "%d", fast_refresh_count);
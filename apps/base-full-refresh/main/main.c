@@ -59,6 +59,9 @@ void e_paper_task(void *pvParameter)
         ESP_LOGI(TAG, "Before ePaper driver init, heap: %d", esp_get_free_heap_size());
         device = iot_epaper_create(NULL, &epaper_conf);
         iot_epaper_set_rotate(device, E_PAPER_ROTATE_90);
+#ifdef CONFIG_EPAPER_SPI_TRACE
+        iot_epaper_trace_start(device);
+#endif
      
 		
 		iot_epaper_clean_paint(device, WHITE);	//clean the whole screen with WHITE	
@@ -73,6 +76,10 @@ void e_paper_task(void *pvParameter)
 
         
         iot_epaper_display_frame(device);
+#ifdef CONFIG_EPAPER_SPI_TRACE
+        // save the console log, host/trace_replay.c picks the trace out of it
+        iot_epaper_trace_dump(device, stdout, true);
+#endif
 		
 		
 		vTaskDelay(20000 / portTICK_PERIOD_MS);
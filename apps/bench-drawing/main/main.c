@@ -0,0 +1,73 @@
+/* 2.9" DKE ePaper drawing benchmarks
+   This example code is in the Public Domain (or CC0 licensed, at your option.)
+   Unless required by applicable law or agreed to in writing, this
+   software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+   CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <string.h>
+#include "esp_log.h"
+
+#include "epaper-29-dke.h"
+#include "epaper_fonts.h"
+#include "epaper_bench.h"
+
+static const char *TAG = "ePaper Bench";
+
+// Pin definition of the ePaper module
+#define MOSI_PIN     13
+#define MISO_PIN    -1
+#define SCK_PIN     14
+#define BUSY_PIN    35
+#define DC_PIN      25
+#define RST_PIN     26
+#define CS_PIN      27
+
+void e_paper_bench_task(void *pvParameter)
+{
+    epaper_handle_t device = NULL;
+
+    epaper_conf_t epaper_conf = {
+        .busy_pin = BUSY_PIN,
+        .cs_pin = CS_PIN,
+        .dc_pin = DC_PIN,
+        .miso_pin = MISO_PIN,
+        .mosi_pin = MOSI_PIN,
+        .reset_pin = RST_PIN,
+        .sck_pin = SCK_PIN,
+
+        .rst_active_level = 0,
+        .busy_active_level = 1,
+
+        .dc_lev_data = 1,
+        .dc_lev_cmd = 0,
+
+        .clk_freq_hz = 20 * 1000 * 1000,
+        .spi_host = HSPI_HOST,
+
+        .width = EPD_WIDTH,
+        .height = EPD_HEIGHT,
+        .color_inv = 1,
+        .fast_bw_mode = false,
+    };
+
+    device = iot_epaper_create(NULL, &epaper_conf);
+    if (device == NULL) {
+        ESP_LOGE(TAG, "ePaper driver init failed");
+        vTaskDelete(NULL);
+    }
+
+    //Only the frame buffer is drawn into, the panel is left as it is
+    while (1) {
+        epaper_bench_run(device, 1, NULL, NULL);
+        vTaskDelay(10000 / portTICK_PERIOD_MS);
+    }
+}
+
+void app_main()
+{
+    ESP_LOGI(TAG, "Starting drawing benchmarks");
+    xTaskCreate(&e_paper_bench_task, "epaper_bench_task", 4 * 1024, NULL, 5, NULL);
+}
@@ -0,0 +1,345 @@
+// Drawing primitive benchmarks, see epaper_bench.h
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "epaper-29-dke.h"
+#include "epaper_fonts.h"
+#include "epaper_bench.h"
+
+#ifdef ESP_PLATFORM
+#include "xtensa/core-macros.h"
+#include "esp32/clk.h"
+#else
+#include <time.h>
+#endif
+
+// as much of this as fits on a line of the rotation
+#define BENCH_TEXT      "0123456789"
+#define BENCH_TEXT_LEN  10
+
+typedef struct {
+    uint64_t ns;
+    uint64_t cycles;
+} bench_time_t;
+
+#ifdef ESP_PLATFORM
+// the cycle counter wraps after 2^32 cycles, 17 s at 240 MHz, every case is far shorter
+static uint32_t s_start;
+
+static void bench_start(void)
+{
+    s_start = xthal_get_ccount();
+}
+
+static bench_time_t bench_stop(void)
+{
+    bench_time_t t;
+    t.cycles = (uint32_t) (xthal_get_ccount() - s_start);
+    t.ns = t.cycles * 1000 / (esp_clk_cpu_freq() / 1000000);
+    return t;
+}
+#else
+static struct timespec s_start;
+
+static void bench_start(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &s_start);
+}
+
+static bench_time_t bench_stop(void)
+{
+    struct timespec end;
+    bench_time_t t;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    t.ns = (uint64_t) (end.tv_sec - s_start.tv_sec) * 1000000000ULL + end.tv_nsec - s_start.tv_nsec;
+    t.cycles = 0;
+    return t;
+}
+#endif
+
+// the file-static spinlock every pixel used to enter, see BENCH_PIXEL_CRITICAL
+static portMUX_TYPE s_pixel_lock = portMUX_INITIALIZER_UNLOCKED;
+
+typedef enum {
+    BENCH_CLEAN,
+    BENCH_CLEAN_PIXELS,
+    BENCH_PIXEL,
+    BENCH_PIXEL_CRITICAL,
+    BENCH_STRING,
+    BENCH_STRING_PIXELS,
+    BENCH_LINE,
+    BENCH_HLINE,
+    BENCH_HLINE_PIXELS,
+    BENCH_VLINE,
+    BENCH_VLINE_PIXELS,
+    BENCH_RECT,
+    BENCH_FILLED_RECT,
+    BENCH_FILLED_RECT_PIXELS,
+    BENCH_CIRCLE,
+    BENCH_FILLED_CIRCLE,
+    BENCH_CIRCLE_LINES,
+} bench_op_t;
+
+typedef struct {
+    const char* name;
+    bench_op_t op;
+    uint32_t calls;
+    epaper_font_t* font;
+    int size;           /* line length, rectangle side, circle radius or glyph cache budget */
+} bench_case_t;
+
+// a name ending in /pixel, /line or /critical is the reference the call above it replaced
+static const bench_case_t s_cases[] = {
+    { "clean_paint",                 BENCH_CLEAN,               20,    NULL,            0 },
+    { "clean_paint/pixel",           BENCH_CLEAN_PIXELS,        5,     NULL,            0 },
+    { "pixel_write",                 BENCH_PIXEL,               10000, NULL,            0 },
+    { "pixel_write/critical",        BENCH_PIXEL_CRITICAL,      10000, NULL,            0 },
+    { "draw_string font_8",          BENCH_STRING,              200,   &epaper_font_8,  0 },
+    { "draw_string font_12",         BENCH_STRING,              200,   &epaper_font_12, 0 },
+    { "draw_string font_16",         BENCH_STRING,              200,   &epaper_font_16, 0 },
+    { "draw_string font_16/pixel",   BENCH_STRING_PIXELS,       20,    &epaper_font_16, 0 },
+    { "draw_string font_16 cached",  BENCH_STRING,              200,   &epaper_font_16, 4096 },
+    { "draw_string font_20",         BENCH_STRING,              100,   &epaper_font_20, 0 },
+    { "draw_string font_24",         BENCH_STRING,              100,   &epaper_font_24, 0 },
+    { "draw_string font_60",         BENCH_STRING,              20,    &epaper_font_60, 0 },
+    { "draw_string font_60/pixel",   BENCH_STRING_PIXELS,       5,     &epaper_font_60, 0 },
+    { "draw_string font_60 cached",  BENCH_STRING,              20,    &epaper_font_60, 4096 },
+    { "draw_line 100",               BENCH_LINE,                1000,  NULL,            100 },
+    { "horizontal_line 100",         BENCH_HLINE,               1000,  NULL,            100 },
+    { "horizontal_line 100/pixel",   BENCH_HLINE_PIXELS,        1000,  NULL,            100 },
+    { "vertical_line 100",           BENCH_VLINE,               1000,  NULL,            100 },
+    { "vertical_line 100/pixel",     BENCH_VLINE_PIXELS,        1000,  NULL,            100 },
+    { "draw_rectangle 100",          BENCH_RECT,                500,   NULL,            100 },
+    { "filled_rectangle 100",        BENCH_FILLED_RECT,         100,   NULL,            100 },
+    { "filled_rectangle 100/pixel",  BENCH_FILLED_RECT_PIXELS,  10,    NULL,            100 },
+    { "draw_circle r50",             BENCH_CIRCLE,              500,   NULL,            50 },
+    { "filled_circle r50",           BENCH_FILLED_CIRCLE,       100,   NULL,            50 },
+    { "filled_circle r50/line",      BENCH_CIRCLE_LINES,        100,   NULL,            50 },
+};
+
+/**
+ *  @brief: this draws a string the way iot_epaper_draw_char did before the
+ *          glyph blit, one iot_epaper_draw_pixel() per set bit of the font
+ */
+static void bench_draw_string_pixels(epaper_handle_t dev, int x, int y, const char* text, epaper_font_t* font, int colored)
+{
+    int stride = font->width / 8 + (font->width % 8 ? 1 : 0);
+    for (; *text; text++, x += font->width) {
+        const unsigned char* ptr = &font->font_table[(*text - ' ') * font->height * stride];
+        for (int j = 0; j < font->height; j++, ptr += stride) {
+            for (int i = 0; i < font->width; i++) {
+                if (ptr[i / 8] & (0x80 >> (i % 8))) {
+                    iot_epaper_draw_pixel(dev, x + i, y + j, colored);
+                }
+            }
+        }
+    }
+}
+
+/**
+ *  @brief: this fills a box the way the line and filled rectangle calls did
+ *          before the span fill, column by column, one iot_epaper_draw_pixel()
+ *          per pixel
+ */
+static void bench_fill_pixels(epaper_handle_t dev, int x0, int y0, int x1, int y1, int colored)
+{
+    for (int x = x0; x <= x1; x++) {
+        for (int y = y0; y <= y1; y++) {
+            iot_epaper_draw_pixel(dev, x, y, colored);
+        }
+    }
+}
+
+/**
+ *  @brief: this fills a circle the way iot_epaper_draw_filled_circle did before
+ *          the span fill, two lines per Bresenham step, rows drawn many times
+ */
+static void bench_filled_circle_lines(epaper_handle_t dev, int x, int y, int radius, int colored)
+{
+    int x_pos = -radius;
+    int y_pos = 0;
+    int err = 2 - 2 * radius;
+    int e2;
+    do {
+        iot_epaper_draw_pixel(dev, x - x_pos, y + y_pos, colored);
+        iot_epaper_draw_pixel(dev, x + x_pos, y + y_pos, colored);
+        iot_epaper_draw_pixel(dev, x + x_pos, y - y_pos, colored);
+        iot_epaper_draw_pixel(dev, x - x_pos, y - y_pos, colored);
+        iot_epaper_draw_horizontal_line(dev, x + x_pos, y + y_pos, 1 - 2 * x_pos, colored);
+        iot_epaper_draw_horizontal_line(dev, x + x_pos, y - y_pos, 1 - 2 * x_pos, colored);
+        e2 = err;
+        if (e2 <= y_pos) {
+            err += ++y_pos * 2 + 1;
+            if (-x_pos == y_pos && e2 <= x_pos) {
+                e2 = 0;
+            }
+        }
+        if (e2 > x_pos) {
+            err += ++x_pos * 2 + 1;
+        }
+    } while (x_pos <= 0);
+}
+
+/**
+ *  @brief: this makes one call of a case, x and y vary so calls do not
+ *          all hit the same bytes. Returns the pixels covered.
+ */
+static uint32_t bench_call(epaper_handle_t dev, const bench_case_t* c, uint32_t i)
+{
+    int w = iot_epaper_get_width(dev);
+    int h = iot_epaper_get_height(dev);
+    int s = c->size;
+    int x, y, n;
+    unsigned char* image = iot_epaper_get_image(dev);
+
+    switch (c->op) {
+        case BENCH_CLEAN:
+            iot_epaper_clean_paint(dev, i & 1 ? BLACK : WHITE);
+            return w * h;
+        case BENCH_CLEAN_PIXELS:
+            // what iot_epaper_clean_paint did before the plane fill
+            for (x = 0; x < w; x++) {
+                for (y = 0; y < h; y++) {
+                    iot_epaper_draw_pixel(dev, x, y, i & 1 ? BLACK : WHITE);
+                }
+            }
+            return w * h;
+        case BENCH_PIXEL:
+            // the write each pixel of a drawing call makes under the paint mutex
+            n = i % (w * h);
+            image[n / 8] &= ~(0x80 >> (n % 8));
+            return 1;
+        case BENCH_PIXEL_CRITICAL:
+            // the same write as it was made before, interrupts masked around
+            // each one, ns/call bounds the latency every pixel added
+            n = i % (w * h);
+            portENTER_CRITICAL(&s_pixel_lock);
+            image[n / 8] &= ~(0x80 >> (n % 8));
+            portEXIT_CRITICAL(&s_pixel_lock);
+            return 1;
+        case BENCH_STRING:
+        case BENCH_STRING_PIXELS: {
+            char text[BENCH_TEXT_LEN + 1];
+            n = w / c->font->width < BENCH_TEXT_LEN ? w / c->font->width : BENCH_TEXT_LEN;
+            memcpy(text, BENCH_TEXT, n);
+            text[n] = '\0';
+            x = i % (w - n * c->font->width + 1);
+            y = i % (h - c->font->height + 1);
+            if (c->op == BENCH_STRING) {
+                iot_epaper_draw_string(dev, x, y, text, c->font, BLACK);
+            } else {
+                bench_draw_string_pixels(dev, x, y, text, c->font, BLACK);
+            }
+            return n * c->font->width * c->font->height;
+        }
+        case BENCH_LINE:
+            x = i % (w - s);
+            y = i % (h - s / 2);
+            iot_epaper_draw_line(dev, x, y, x + s - 1, y + s / 2 - 1, BLACK);
+            return s;
+        case BENCH_HLINE:
+            iot_epaper_draw_horizontal_line(dev, i % (w - s), i % h, s, BLACK);
+            return s;
+        case BENCH_HLINE_PIXELS:
+            bench_fill_pixels(dev, i % (w - s), i % h, i % (w - s) + s - 1, i % h, BLACK);
+            return s;
+        case BENCH_VLINE:
+            iot_epaper_draw_vertical_line(dev, i % w, i % (h - s), s, BLACK);
+            return s;
+        case BENCH_VLINE_PIXELS:
+            bench_fill_pixels(dev, i % w, i % (h - s), i % w, i % (h - s) + s - 1, BLACK);
+            return s;
+        case BENCH_RECT:
+        case BENCH_FILLED_RECT:
+        case BENCH_FILLED_RECT_PIXELS:
+            // clipped to the short side in the portrait rotations
+            s = s < w ? s : w;
+            s = s < h ? s : h;
+            x = i % (w - s + 1);
+            y = i % (h - s + 1);
+            if (c->op == BENCH_RECT) {
+                iot_epaper_draw_rectangle(dev, x, y, x + s - 1, y + s - 1, BLACK);
+                return 4 * s - 4;
+            }
+            if (c->op == BENCH_FILLED_RECT) {
+                iot_epaper_draw_filled_rectangle(dev, x, y, x + s - 1, y + s - 1, BLACK);
+            } else {
+                bench_fill_pixels(dev, x, y, x + s - 1, y + s - 1, BLACK);
+            }
+            return s * s;
+        case BENCH_CIRCLE:
+            iot_epaper_draw_circle(dev, s + i % (w - 2 * s), s + i % (h - 2 * s), s, BLACK);
+            return 2 * 355 * s / 113;
+        case BENCH_FILLED_CIRCLE:
+            iot_epaper_draw_filled_circle(dev, s + i % (w - 2 * s), s + i % (h - 2 * s), s, BLACK);
+            return 355 * s * s / 113;
+        case BENCH_CIRCLE_LINES:
+            bench_filled_circle_lines(dev, s + i % (w - 2 * s), s + i % (h - 2 * s), s, BLACK);
+            return 355 * s * s / 113;
+        default:
+            return 0;
+    }
+}
+
+int epaper_bench_run(epaper_handle_t dev, uint32_t repeat, epaper_bench_report_t report, void* arg)
+{
+    int rotate = iot_epaper_get_rotate(dev);
+    int count = 0;
+
+    if (report == NULL) {
+        epaper_bench_print_header();
+        report = epaper_bench_print;
+    }
+    for (int r = E_PAPER_ROTATE_0; r <= E_PAPER_ROTATE_270; r++) {
+        iot_epaper_set_rotate(dev, r);
+        for (size_t k = 0; k < sizeof(s_cases) / sizeof(s_cases[0]); k++) {
+            const bench_case_t* c = &s_cases[k];
+            epaper_bench_result_t result = {
+                .name = c->name,
+                .rotate = r,
+                .calls = c->calls * repeat,
+            };
+            bench_time_t t;
+
+            iot_epaper_clean_paint(dev, WHITE);
+            // cached glyphs only differ in E_PAPER_ROTATE_90, the first calls fill the cache
+            iot_epaper_set_glyph_cache(dev, c->op == BENCH_STRING ? c->size : 0);
+            bench_start();
+            for (uint32_t i = 0; i < result.calls; i++) {
+                result.pixels += bench_call(dev, c, i);
+            }
+            t = bench_stop();
+            result.ns = t.ns;
+            result.cycles = t.cycles;
+            report(&result, arg);
+            count++;
+            // let the idle task feed the watchdog
+            vTaskDelay(1);
+        }
+    }
+    iot_epaper_set_glyph_cache(dev, 0);
+    iot_epaper_set_rotate(dev, rotate);
+    return count;
+}
+
+void epaper_bench_print_header(void)
+{
+    printf("%-26s %4s %7s %12s %12s %10s\n", "case", "rot", "calls", "ns/call", "cycles/call", "Mpixel/s");
+}
+
+void epaper_bench_print(const epaper_bench_result_t* result, void* arg)
+{
+    double ns = result->calls ? (double) result->ns / result->calls : 0;
+    double cycles = result->calls ? (double) result->cycles / result->calls : 0;
+    double mpixels = result->ns ? result->pixels * 1000.0 / result->ns : 0;
+    char cycles_text[16] = "-";
+
+    (void) arg;     // it is an epaper_bench_report_t, printing needs no state
+    if (result->cycles) {
+        snprintf(cycles_text, sizeof(cycles_text), "%.1f", cycles);
+    }
+    printf("%-26s %4d %7u %12.1f %12s %10.2f\n", result->name, result->rotate * 90,
+           (unsigned) result->calls, ns, cycles_text, mpixels);
+}
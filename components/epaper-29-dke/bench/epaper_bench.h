@@ -0,0 +1,56 @@
+// Drawing primitive benchmarks of the epaper-29-dke component. The same code
+// runs on the host build (clock_gettime) and on the ESP32 (CPU cycle counter).
+
+#ifndef _EPAPER_BENCH_H_
+#define _EPAPER_BENCH_H_
+
+#include <stdint.h>
+#include "epaper-29-dke.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* One benchmark case, measured in one rotation */
+typedef struct
+{
+    const char* name;
+    int rotate;
+    uint32_t calls;
+    uint64_t pixels;        /* pixels covered by all calls */
+    uint64_t ns;            /* time of all calls */
+    uint64_t cycles;        /* CPU cycles of all calls, 0 on the host */
+} epaper_bench_result_t;
+
+/* Called after every case, e.g. to print it */
+typedef void (*epaper_bench_report_t)(const epaper_bench_result_t* result, void* arg);
+
+/**
+ * @brief   time every drawing call in the four rotations. The frame buffer
+ *          of the device is drawn over, nothing is sent to the panel. The
+ *          glyph cache is left disabled.
+ *
+ * @param  dev object handle of epaper
+ * @param  repeat calls of each case are multiplied by this, 1 on the ESP32
+ * @param  report called after each case, NULL to print the results
+ * @param  arg passed to report
+ *
+ * @return
+ *     - number of cases run
+ */
+int epaper_bench_run(epaper_handle_t dev, uint32_t repeat, epaper_bench_report_t report, void* arg);
+
+/**
+ * @brief   print a result as one line of the table started by
+ *          epaper_bench_print_header()
+ */
+void epaper_bench_print(const epaper_bench_result_t* result, void* arg);
+
+void epaper_bench_print_header(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -20,6 +20,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
+#include <limits.h>
 #include "driver/gpio.h"
 #include "driver/spi_master.h"
 
@@ -30,12 +31,29 @@
 #include "freertos/queue.h"
 #include "freertos/ringbuf.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "soc/soc_memory_layout.h"
 
 #include "epaper-29-dke.h"
 
 static const char* TAG = "ePaper Driver";
 
-#define EPAPER_QUE_SIZE_DEFAULT 10
+#define EPAPER_QUE_SIZE_DEFAULT 16     // a whole BWR frame push fits in the queue
+#define EPAPER_WINDOW_CHUNK_SIZE 256    // bytes gathered per transaction by display_region
+#ifndef CONFIG_EPAPER_ASYNC_TASK_STACK
+#define CONFIG_EPAPER_ASYNC_TASK_STACK 4096
+#endif
+#define EPAPER_ASYNC_TASK_STACK CONFIG_EPAPER_ASYNC_TASK_STACK  // done_cb runs on it
+#ifndef CONFIG_EPAPER_SERVICE_TASK_STACK
+#define CONFIG_EPAPER_SERVICE_TASK_STACK 4096
+#endif
+#define EPAPER_SERVICE_TASK_STACK CONFIG_EPAPER_SERVICE_TASK_STACK
+#define EPAPER_BUSY_TIMEOUT_MS  30000   // longest refresh is a full BWR update, about 15 s
+#define EPAPER_BUSY_RECHECK_MS  100     // busy pin read again this often while woken by the interrupt
+#define EPAPER_LUT_MAX          8       // built-in and registered waveforms
+#define EPAPER_LUT_NONE         -1      // controller runs the OTP waveform, or nothing known loaded
+#define EPAPER_GHOST_COLS       4       // regions the fast refreshes are counted in, along the panel width
+#define EPAPER_GHOST_ROWS       8       // and along the panel height
 
 
 const unsigned char lut_full_update[] =
@@ -70,9 +88,45 @@ const unsigned char lut_partial_update[] =
     0x00, 0x00, 0x00, 0x00, 0x00
 };
 
-static portMUX_TYPE epaper_spinlock = portMUX_INITIALIZER_UNLOCKED;
-#define EPAPER_ENTER_CRITICAL(mux)    portENTER_CRITICAL(mux)
-#define EPAPER_EXIT_CRITICAL(mux)     portEXIT_CRITICAL(mux)
+/* Controller init sequences, run by iot_epaper_run_sequence(). Each step is
+ * the command, a byte with the parameter count and EPAPER_SEQ_ flags, then the
+ * parameters. A panel variant is a common part plus one of the mode parts.
+ */
+#define EPAPER_SEQ_WAIT_BUSY    0x80    // wait for the busy pin after this step
+#define EPAPER_SEQ_LUT          0x40    // the parameters are the waveform LUT, none in the table
+#define EPAPER_SEQ_COUNT_MASK   0x3F
+
+static const uint8_t epaper_init_common[] =
+{
+    E_PAPER_SW_RESET, EPAPER_SEQ_WAIT_BUSY | 0,
+    0x74, 1, 0x54,                  // Set analog block control
+    0x7E, 1, 0x3B,                  // Set digital block control
+    0x11, 1, 0x03,                  // RAM data entry mode, Y increment, X increment
+    0x3C, 1, 0x01,                  // Set border waveform for VBD
+};
+
+static const uint8_t epaper_init_fast_bw[] =
+{
+    E_PAPER_WRITE_VCOM_REGISTER, 1, 0x26,
+    0x03, 1, 0x17,                  // Gate voltage setting (17h = 20 Volt, ranges from 10v to 21v)
+    0x04, 3, 0x41, 0x00, 0x32,      // Source voltage setting (15volt, 0 volt and -15 volt)
+    E_PAPER_WRITE_LUT_REGISTER, EPAPER_SEQ_LUT,
+    0x3A, 1, 26,                    // 26 dummy lines per gate
+    0x3B, 1, 0x08,                  // 62us per line
+    E_PAPER_DRIVER_OUTPUT_CONTROL, 3, 0x27, 0x01, 0x00,     // length of update, EPD_HEIGHT - 1
+    0x0f, 2, 0x00, 0x00,            // starting-line of update
+    E_PAPER_SET_RAM_X_ADDRESS_START_END_POSITION, 2, 0x00, (EPD_WIDTH - 1) >> 3,
+    E_PAPER_SET_RAM_Y_ADDRESS_START_END_POSITION, 4, 0x00, 0x00, (EPD_HEIGHT - 1) & 0xff, (EPD_HEIGHT - 1) >> 8,
+};
+
+static const uint8_t epaper_init_bwr[] =
+{
+    0x18, 1, 0x80,                  // Temperature sensor selection
+    E_PAPER_DISPLAY_UPDATE_CONTROL_2, 1, 0xB1,  // Enable the stage for master activation
+    E_PAPER_SET_RAM_X_ADDRESS_START_END_POSITION, 2, 0x00, (EPD_WIDTH - 1) >> 3,
+    E_PAPER_SET_RAM_Y_ADDRESS_START_END_POSITION, 4, 0x00, 0x00, (EPD_HEIGHT - 1) & 0xff, (EPD_HEIGHT - 1) >> 8,
+    E_PAPER_MASTER_ACTIVATION, 0,
+};
 
 // LCD data/command
 typedef struct {
@@ -80,12 +134,109 @@ typedef struct {
     uint8_t dc_level;
 } epaper_dc_t;
 
+#ifdef CONFIG_EPAPER_SPI_TRACE
+// User data of a queued transaction while tracing, the D/C level comes first
+// so a pre-transfer callback can read it as a plain epaper_dc_t
+typedef struct {
+    epaper_dc_t dc;
+    volatile int64_t start_us;  /* set by the transfer callbacks, in irq context */
+    volatile int64_t end_us;
+} epaper_trace_slot_t;
+
+// SPI trace, whole records in a ring buffer, the oldest overwritten first
+typedef struct {
+    uint8_t* buf;
+    size_t size;
+    size_t head;        /* where the next record goes */
+    size_t tail;        /* oldest record */
+    size_t used;
+    uint32_t records;
+    uint32_t dropped;   /* records overwritten since iot_epaper_trace_start() */
+    bool on;
+} epaper_trace_t;
+#endif
+
+// Glyph pre-rotated for E_PAPER_ROTATE_90, in the native byte layout:
+// one row per glyph column, glyph rows bottom up from the MSB of the first byte
+typedef struct epaper_glyph {
+    const epaper_font_t* font;
+    char ascii_char;
+    size_t size;                // bytes taken from the cache budget
+    struct epaper_glyph* next;  // most recently used first
+    uint8_t bits[];
+} epaper_glyph_t;
+
+// Waveform in the LUT registry
+typedef struct {
+    const uint8_t* data;
+    size_t size;
+    epaper_busy_stats_t refresh;    /* refreshes made with this waveform */
+} epaper_lut_entry_t;
+
+// Frame queued by iot_epaper_display_frame_async
+typedef struct {
+    epaper_frame_done_cb_t done_cb;
+    void* arg;
+    epaper_paint_t* frame;      /* planes handed over by iot_epaper_swap_frame, NULL for the frame buffer */
+} epaper_async_job_t;
+
+// Frame submitted to the display service
+typedef struct {
+    epaper_area_t window;   // controller RAM window, absolute coordinates
+    bool fast_bw_mode;
+} epaper_service_job_t;
+
 typedef struct {
     spi_device_handle_t bus;
     epaper_conf_t pin;      /* EPD properties */
     epaper_paint_t paint;   /* Paint properties */
-    epaper_dc_t dc;
-    xSemaphoreHandle spi_mux;
+    xSemaphoreHandle spi_mux;   /* serialises access to the panel over SPI */
+    xSemaphoreHandle paint_mux; /* serialises access to the frame buffer, taken once per drawing call */
+    epaper_glyph_t* glyph_cache;
+    epaper_glyph_cache_stats_t glyph_stats;
+    xQueueHandle async_queue;
+    xSemaphoreHandle async_done;    /* available while no asynchronous frame is in flight */
+    xSemaphoreHandle async_started; /* the driver task holds the frame buffer */
+    TaskHandle_t async_task;        /* created by the first iot_epaper_display_frame_async() */
+    epaper_paint_t spare;           /* second pair of planes, owned by the driver task while in flight */
+    epaper_dc_t dc_cmd;             /* D/C levels of queued command and data transactions */
+    epaper_dc_t dc_data;
+    spi_transaction_t trans[EPAPER_QUE_SIZE_DEFAULT];
+    epaper_stats_t stats;           /* performance counters since the device was created */
+    portMUX_TYPE stats_lock;        /* guards stats and busy_edge_us, iot_epaper_get_stats() may run in any task */
+    int render_depth;               /* drawing calls in progress, nested ones count once */
+    int64_t render_start_us;
+    int64_t refresh_start_us;       /* first byte of the refresh in progress sent */
+    bool refresh_fast;              /* the refresh in progress is a fast B/W one */
+    xSemaphoreHandle busy_sem;      /* given by the busy pin interrupt when the panel gets idle */
+    bool busy_isr;                  /* false if the interrupt could not be set up, busy pin is polled */
+    int64_t busy_edge_us;           /* when the interrupt last saw the panel get idle */
+    epaper_busy_stats_t busy_stats[E_PAPER_BUSY_MAX];
+    epaper_lut_entry_t luts[EPAPER_LUT_MAX];
+    int lut_count;
+    int lut_selected;       /* waveform for the next fast mode refresh */
+    int lut_loaded;         /* waveform in the controller LUT register */
+    int lut_refresh;        /* waveform of the refresh in progress */
+    uint16_t ghost_count[EPAPER_GHOST_ROWS][EPAPER_GHOST_COLS];  /* fast refreshes since the last full one */
+    uint16_t ghost_budget;  /* fast refreshes a region may take, 0 for no limit */
+    bool ghost_auto;        /* do the full refresh when the budget is used up */
+    size_t arena_size;      /* the device and the planes it was created with, in one block */
+    bool static_storage;    /* the block belongs to the caller, see iot_epaper_create_static() */
+    bool red_on_demand;     /* created without a red plane, it is only held in BWR mode */
+    uint32_t* row_hash;     /* per row hash of the planes in the controller RAM */
+    bool row_hash_valid;    /* the RAM holds what row_hash says */
+    TaskHandle_t service_task;          /* display service, see iot_epaper_service_start() */
+    xQueueHandle service_queue;         /* latest submission, overwritten by newer ones */
+    xSemaphoreHandle service_mux;       /* guards the fields below */
+    epaper_paint_t service_frame;       /* frames as submitted, newest content in every window */
+    epaper_paint_t service_work;        /* the part being pushed */
+    epaper_service_job_t service_job;   /* what service_frame holds that is not pushed yet */
+    bool service_pending;
+    epaper_service_stats_t service_stats;
+#ifdef CONFIG_EPAPER_SPI_TRACE
+    epaper_trace_slot_t trace_slot[EPAPER_QUE_SIZE_DEFAULT];   /* user data of trans[] */
+    epaper_trace_t trace;
+#endif
 } epaper_dev_t;
 
 /* This function is called (in irq context!) just before a transmission starts.
@@ -97,51 +248,164 @@ static void iot_epaper_pre_transfer_callback(spi_transaction_t *t)
     gpio_set_level((int)dc->dc_io, (int)dc->dc_level);
 }
 
-static esp_err_t _iot_epaper_spi_send(spi_device_handle_t spi, spi_transaction_t* t)
+#ifdef CONFIG_EPAPER_SPI_TRACE
+/* The same with the start and end of each transaction taken for the trace */
+static void iot_epaper_pre_transfer_trace(spi_transaction_t *t)
+{
+    epaper_trace_slot_t *slot = (epaper_trace_slot_t *) t->user;
+    iot_epaper_pre_transfer_callback(t);
+    slot->start_us = esp_timer_get_time();
+}
+
+static void iot_epaper_post_transfer_trace(spi_transaction_t *t)
+{
+    epaper_trace_slot_t *slot = (epaper_trace_slot_t *) t->user;
+    slot->end_us = esp_timer_get_time();
+}
+#endif
+
+/**
+ *  @brief: this queues one transaction, flushing the queue first when it is
+ *          full. Up to 4 bytes are copied into the transaction, longer data is
+ *          sent from place and must stay valid until iot_epaper_flush_trans().
+ */
+static void iot_epaper_queue_trans(epaper_dev_t* device, int* count, const uint8_t* data, int length, epaper_dc_t* dc);
+
+#ifdef CONFIG_EPAPER_SPI_TRACE
+/**
+ *  @brief: this copies n bytes to the head of the trace ring buffer
+ */
+static void iot_epaper_trace_put(epaper_trace_t* trace, const void* src, size_t n)
+{
+    size_t first = trace->size - trace->head;
+    first = first < n ? first : n;
+    memcpy(trace->buf + trace->head, src, first);
+    memcpy(trace->buf, (const uint8_t*) src + first, n - first);
+    trace->head = (trace->head + n) % trace->size;
+    trace->used += n;
+}
+
+/**
+ *  @brief: this drops the oldest record of the trace
+ */
+static void iot_epaper_trace_drop(epaper_trace_t* trace)
+{
+    epaper_trace_record_t rec;
+    size_t first = trace->size - trace->tail;
+    first = first < sizeof(rec) ? first : sizeof(rec);
+    memcpy(&rec, trace->buf + trace->tail, first);
+    memcpy((uint8_t*) &rec + first, trace->buf, sizeof(rec) - first);
+    trace->tail = (trace->tail + sizeof(rec) + rec.captured) % trace->size;
+    trace->used -= sizeof(rec) + rec.captured;
+    trace->records--;
+    trace->dropped++;
+}
+
+/**
+ *  @brief: this adds a finished transaction to the trace, with up to
+ *          CONFIG_EPAPER_SPI_TRACE_DATA_MAX bytes of what it sent
+ */
+static void iot_epaper_trace_record(epaper_dev_t* device, const spi_transaction_t* t)
+{
+    epaper_trace_t* trace = &device->trace;
+    const epaper_trace_slot_t* slot = (const epaper_trace_slot_t*) t->user;
+    const uint8_t* data = (t->flags & SPI_TRANS_USE_TXDATA) ? t->tx_data : (const uint8_t*) t->tx_buffer;
+    epaper_trace_record_t rec = {
+        .start_us = (uint32_t) slot->start_us,
+        .duration_us = (uint32_t) (slot->end_us - slot->start_us),
+        .length = t->length / 8,
+        .dc_level = slot->dc.dc_level,
+        .flags = slot->dc.dc_level == device->pin.dc_lev_cmd ? E_PAPER_TRACE_COMMAND : 0,
+    };
+    size_t captured = rec.length;
+
+    if (!trace->on) {
+        return;
+    }
+    captured = captured < CONFIG_EPAPER_SPI_TRACE_DATA_MAX ? captured : CONFIG_EPAPER_SPI_TRACE_DATA_MAX;
+    captured = captured < trace->size - sizeof(rec) ? captured : trace->size - sizeof(rec);
+    if (captured < rec.length) {
+        rec.flags |= E_PAPER_TRACE_TRUNCATED;
+    }
+    rec.captured = captured;
+    while (trace->size - trace->used < sizeof(rec) + captured) {
+        iot_epaper_trace_drop(trace);
+    }
+    iot_epaper_trace_put(trace, &rec, sizeof(rec));
+    iot_epaper_trace_put(trace, data, captured);
+    trace->records++;
+}
+#endif
+
+/**
+ *  @brief: this waits for the transactions queued so far
+ */
+static void iot_epaper_flush_trans(epaper_dev_t* device, int* count)
 {
-    return spi_device_transmit(spi, t);
+    spi_transaction_t* t;
+    esp_err_t ret;
+    while (*count) {
+        ret = spi_device_get_trans_result(device->bus, &t, portMAX_DELAY);
+        assert(ret == ESP_OK);
+#ifdef CONFIG_EPAPER_SPI_TRACE
+        iot_epaper_trace_record(device, t);
+#endif
+        (*count)--;
+    }
 }
 
-void iot_epaper_send(spi_device_handle_t spi, const uint8_t *data, int len, epaper_dc_t *dc)
+static void iot_epaper_queue_trans(epaper_dev_t* device, int* count, const uint8_t* data, int length, epaper_dc_t* dc)
 {
+    spi_transaction_t* t;
     esp_err_t ret;
-    if (len == 0) {
+
+    if (length == 0) {
         return;    // no need to send anything
     }
-    spi_transaction_t t = {
-        .length = len * 8,  // Len is in bytes, transaction length is in bits.
-        .tx_buffer = data,
-        .user = (void *) dc,
-    };
-    ret = _iot_epaper_spi_send(spi, &t);
+    if (*count == EPAPER_QUE_SIZE_DEFAULT) {
+        iot_epaper_flush_trans(device, count);
+    }
+    t = &device->trans[(*count)++];
+    memset(t, 0, sizeof(spi_transaction_t));
+    t->length = length * 8;     // Len is in bytes, transaction length is in bits.
+#ifdef CONFIG_EPAPER_SPI_TRACE
+    device->trace_slot[t - device->trans].dc = *dc;
+    t->user = (void *) &device->trace_slot[t - device->trans];
+#else
+    t->user = (void *) dc;
+#endif
+    if (length <= (int) sizeof(t->tx_data)) {
+        t->flags = SPI_TRANS_USE_TXDATA;
+        memcpy(t->tx_data, data, length);
+    } else {
+        t->tx_buffer = data;
+    }
+    ret = spi_device_queue_trans(device->bus, t, portMAX_DELAY);
     assert(ret == ESP_OK);
+    portENTER_CRITICAL(&device->stats_lock);
+    device->stats.spi_transactions++;
+    device->stats.spi_bytes += length;
+    portEXIT_CRITICAL(&device->stats_lock);
 }
 
-static void iot_epaper_send_command(epaper_handle_t dev, unsigned char command)
+/**
+ *  @brief: this queues a command and its parameters, two transactions with
+ *          the D/C line switched in between
+ */
+static void iot_epaper_queue_command(epaper_dev_t* device, int* count, uint8_t command, const uint8_t* params, int length)
 {
-    epaper_dev_t* device = (epaper_dev_t*) dev;
-    device->dc.dc_io = device->pin.dc_pin;
-    device->dc.dc_level = device->pin.dc_lev_cmd;
-    iot_epaper_send(device->bus, &command, 1, &device->dc);
+    iot_epaper_queue_trans(device, count, &command, 1, &device->dc_cmd);
+    iot_epaper_queue_trans(device, count, params, length, &device->dc_data);
 }
 
-static void iot_epaper_send_byte(epaper_handle_t dev, const uint8_t data)
+static void iot_epaper_queue_command_byte(epaper_dev_t* device, int* count, uint8_t command, uint8_t param)
 {
-    epaper_dev_t* device = (epaper_dev_t*) dev;
-    device->dc.dc_io = device->pin.dc_pin;
-    device->dc.dc_level = device->pin.dc_lev_data;
-    iot_epaper_send(device->bus, &data, 1, &device->dc);
+    iot_epaper_queue_command(device, count, command, &param, 1);
 }
 
-static void iot_epaper_send_data(epaper_handle_t dev, const uint8_t *data, int length)
+static void iot_epaper_queue_data(epaper_dev_t* device, int* count, const uint8_t* data, int length)
 {
-    epaper_dev_t* device = (epaper_dev_t*) dev;
-    device->dc.dc_io = device->pin.dc_pin;
-    device->dc.dc_level = device->pin.dc_lev_data;
-    // To Do: original driver was sending byte by byte
-    // Pay attention to possible performance issues
-    iot_epaper_send(device->bus, data, length, &device->dc);
-    ESP_LOGI(TAG, "SPI data sent %d", length);
+    iot_epaper_queue_trans(device, count, data, length, &device->dc_data);
 }
 
 static void iot_epaper_paint_init(epaper_handle_t dev, unsigned char* bw_image, unsigned char* r_image, int width, int height)
@@ -153,6 +417,7 @@ static void iot_epaper_paint_init(epaper_handle_t dev, unsigned char* bw_image,
     /* 1 byte = 8 pixels, so the width should be the multiple of 8 */
     device->paint.width = width % 8 ? width + 8 - (width % 8) : width;
     device->paint.height = height;
+    iot_epaper_reset_dirty_area(dev);
 }
 
 static void iot_epaper_gpio_init(epaper_conf_t * pin)
@@ -172,41 +437,147 @@ static void iot_epaper_gpio_init(epaper_conf_t * pin)
 
 
 
-static void iot_epaper_set_lut(epaper_handle_t dev)
+/**
+ *  @brief: this queues the upload of the selected waveform, unless the
+ *          controller has it already
+ */
+static void iot_epaper_queue_lut(epaper_dev_t* device, int* count)
+{
+    epaper_lut_entry_t* lut = &device->luts[device->lut_selected];
+    if (device->lut_loaded == device->lut_selected) {
+        return;
+    }
+    iot_epaper_queue_command(device, count, E_PAPER_WRITE_LUT_REGISTER, lut->data, lut->size);
+    device->lut_loaded = device->lut_selected;
+}
+
+esp_err_t iot_epaper_register_lut(epaper_handle_t dev, const uint8_t* lut, size_t size, int* lut_id)
+{
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    esp_err_t ret = ESP_OK;
+
+    if (lut == NULL || size == 0 || lut_id == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
+    if (device->lut_count == EPAPER_LUT_MAX) {
+        ret = ESP_ERR_NO_MEM;
+    } else {
+        *lut_id = device->lut_count++;
+        memset(&device->luts[*lut_id], 0, sizeof(epaper_lut_entry_t));
+        device->luts[*lut_id].data = lut;
+        device->luts[*lut_id].size = size;
+    }
+    xSemaphoreGiveRecursive(device->spi_mux);
+    return ret;
+}
+
+esp_err_t iot_epaper_select_lut(epaper_handle_t dev, int lut_id)
 {
     epaper_dev_t* device = (epaper_dev_t*) dev;
+
     xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
-    iot_epaper_send_command(dev, E_PAPER_WRITE_LUT_REGISTER);
-    iot_epaper_send_data(dev, lut_full_update, sizeof(lut_full_update));
+    if (lut_id < 0 || lut_id >= device->lut_count) {
+        xSemaphoreGiveRecursive(device->spi_mux);
+        return ESP_ERR_INVALID_ARG;
+    }
+    // uploaded with the next fast mode refresh
+    device->lut_selected = lut_id;
     xSemaphoreGiveRecursive(device->spi_mux);
+    return ESP_OK;
+}
+
+esp_err_t iot_epaper_get_lut_stats(epaper_handle_t dev, int lut_id, epaper_busy_stats_t* stats)
+{
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    if (lut_id < 0 || lut_id >= device->lut_count) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    portENTER_CRITICAL(&device->stats_lock);
+    *stats = device->luts[lut_id].refresh;
+    portEXIT_CRITICAL(&device->stats_lock);
+    return ESP_OK;
 }
 
 
 
 
 
+static void iot_epaper_free_glyph_cache(epaper_dev_t* device)
+{
+    while (device->glyph_cache) {
+        epaper_glyph_t* glyph = device->glyph_cache;
+        device->glyph_cache = glyph->next;
+        free(glyph);
+    }
+    device->glyph_stats.used = 0;
+    device->glyph_stats.glyphs = 0;
+}
+
+/**
+ *  @brief: this frees a plane unless it lies in the block of the device.
+ *          Planes move between the frame buffer and the spare pair on swaps.
+ */
+static void iot_epaper_free_plane(epaper_dev_t* device, unsigned char* plane)
+{
+    if (plane < (unsigned char*) device || plane >= (unsigned char*) device + device->arena_size) {
+        free(plane);
+    }
+}
+
 esp_err_t iot_epaper_delete(epaper_handle_t dev, bool del_bus)
 {
     epaper_dev_t* device = (epaper_dev_t*) dev;
 
-    iot_epaper_sleep(dev);
+    if (device->service_task) {
+        // pending frames are dropped, a frame being pushed is finished first
+        xSemaphoreTake(device->service_mux, portMAX_DELAY);
+        xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
+        vTaskDelete(device->service_task);
+        xSemaphoreGiveRecursive(device->spi_mux);
+        vSemaphoreDelete(device->service_mux);
+        vQueueDelete(device->service_queue);
+        free(device->service_frame.bw_image);
+        free(device->service_frame.r_image);
+        free(device->service_work.bw_image);
+        free(device->service_work.r_image);
+    }
 
+    iot_epaper_wait_frame_done(dev, portMAX_DELAY);
+    if (device->async_task) {
+        vTaskDelete(device->async_task);
+    }
+    iot_epaper_free_plane(device, device->spare.bw_image);
+    iot_epaper_free_plane(device, device->spare.r_image);
+    free(device->row_hash);
+    iot_epaper_sleep(dev);
+#ifdef CONFIG_EPAPER_SPI_TRACE
+    // the sleep command above is still recorded
+    device->trace.on = false;
+    free(device->trace.buf);
+#endif
+
+    if (device->busy_isr) {
+        gpio_isr_handler_remove(device->pin.busy_pin);
+    }
+    if (device->busy_sem) {
+        vSemaphoreDelete(device->busy_sem);
+    }
     spi_bus_remove_device(device->bus);
     if (del_bus) {
         spi_bus_free(device->pin.spi_host);
     }
     vSemaphoreDelete(device->spi_mux);
-    if (device->paint.bw_image) {
-        free(device->paint.bw_image);
-        device->paint.bw_image = NULL;
+    vSemaphoreDelete(device->paint_mux);
+    vSemaphoreDelete(device->async_done);
+    vSemaphoreDelete(device->async_started);
+    vQueueDelete(device->async_queue);
+    iot_epaper_free_glyph_cache(device);
+    iot_epaper_free_plane(device, device->paint.bw_image);
+    iot_epaper_free_plane(device, device->paint.r_image);
+    if (!device->static_storage) {
+        free(device);
     }
-	
-	if (device->paint.r_image) {
-        free(device->paint.r_image);
-        device->paint.r_image = NULL;
-    }
-	
-    free(device);
     return ESP_OK;
 }
 
@@ -219,9 +590,9 @@ int iot_epaper_get_width(epaper_handle_t dev)
 void iot_epaper_set_width(epaper_handle_t dev, int width)
 {
     epaper_dev_t* device = (epaper_dev_t*) dev;
-    xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
+    xSemaphoreTakeRecursive(device->paint_mux, portMAX_DELAY);
     device->paint.width = width % 8 ? width + 8 - (width % 8) : width;
-    xSemaphoreGiveRecursive(device->spi_mux);
+    xSemaphoreGiveRecursive(device->paint_mux);
 
 }
 
@@ -234,9 +605,9 @@ int iot_epaper_get_height(epaper_handle_t dev)
 void iot_epaper_set_height(epaper_handle_t dev, int height)
 {
     epaper_dev_t* device = (epaper_dev_t*) dev;
-    xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
+    xSemaphoreTakeRecursive(device->paint_mux, portMAX_DELAY);
     device->paint.height = height;
-    xSemaphoreGiveRecursive(device->spi_mux);
+    xSemaphoreGiveRecursive(device->paint_mux);
 }
 
 int iot_epaper_get_rotate(epaper_handle_t dev)
@@ -248,16 +619,173 @@ int iot_epaper_get_rotate(epaper_handle_t dev)
 void iot_epaper_set_rotate(epaper_handle_t dev, int rotate)
 {
     epaper_dev_t* device = (epaper_dev_t*) dev;
-    xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
+    xSemaphoreTakeRecursive(device->paint_mux, portMAX_DELAY);
     device->paint.rotate = rotate;
-    xSemaphoreGiveRecursive(device->spi_mux);
+    xSemaphoreGiveRecursive(device->paint_mux);
+}
+
+unsigned char* iot_epaper_get_image(epaper_handle_t dev)
+{
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    return device->paint.bw_image;
+}
+
+unsigned char* iot_epaper_get_red_image(epaper_handle_t dev)
+{
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    return device->paint.r_image;
+}
+
+
+/**
+ *  @brief: these take the frame buffer for a drawing call and add the time it
+ *          was held to the render time. Drawing calls made by other drawing
+ *          calls count once.
+ */
+static void iot_epaper_render_begin(epaper_dev_t* device)
+{
+    xSemaphoreTakeRecursive(device->paint_mux, portMAX_DELAY);
+    if (device->render_depth++ == 0) {
+        device->render_start_us = esp_timer_get_time();
+    }
+}
+
+static void iot_epaper_render_end(epaper_dev_t* device)
+{
+    if (--device->render_depth == 0) {
+        uint32_t us = (uint32_t) (esp_timer_get_time() - device->render_start_us);
+        portENTER_CRITICAL(&device->stats_lock);
+        device->stats.render_us += us;
+        device->stats.render_calls++;
+        portEXIT_CRITICAL(&device->stats_lock);
+    }
+    xSemaphoreGiveRecursive(device->paint_mux);
+}
+
+/**
+ *  @brief: this widens the dirty area by a box given in absolute coordinates,
+ *          clipped to the frame buffer.
+ */
+static void iot_epaper_mark_dirty(epaper_dev_t* device, int x0, int y0, int x1, int y1)
+{
+    epaper_area_t* dirty = &device->paint.dirty;
+    x0 = x0 < 0 ? 0 : x0;
+    y0 = y0 < 0 ? 0 : y0;
+    x1 = x1 >= device->paint.width ? device->paint.width - 1 : x1;
+    y1 = y1 >= device->paint.height ? device->paint.height - 1 : y1;
+    if (x0 > x1 || y0 > y1) {
+        return;
+    }
+    dirty->x0 = x0 < dirty->x0 ? x0 : dirty->x0;
+    dirty->y0 = y0 < dirty->y0 ? y0 : dirty->y0;
+    dirty->x1 = x1 > dirty->x1 ? x1 : dirty->x1;
+    dirty->y1 = y1 > dirty->y1 ? y1 : dirty->y1;
+}
+
+/**
+ *  @brief: this maps a point from the current rotation to absolute coordinates,
+ *          the same way iot_epaper_draw_pixel() does.
+ */
+static void iot_epaper_rotate_point(epaper_dev_t* device, int* x, int* y)
+{
+    int point_temp;
+    switch (device->paint.rotate) {
+        case E_PAPER_ROTATE_90:
+            point_temp = *x;
+            *x = device->paint.width - *y;
+            *y = point_temp;
+            break;
+        case E_PAPER_ROTATE_180:
+            *x = device->paint.width - *x;
+            *y = device->paint.height - *y;
+            break;
+        case E_PAPER_ROTATE_270:
+            point_temp = *x;
+            *x = *y;
+            *y = device->paint.height - point_temp;
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ *  @brief: this maps a point from absolute coordinates to the current rotation.
+ *          The caller holds paint_mux.
+ */
+static void iot_epaper_unrotate_point(epaper_dev_t* device, int* x, int* y)
+{
+    int point_temp;
+    switch (device->paint.rotate) {
+        case E_PAPER_ROTATE_90:
+            point_temp = *y;
+            *y = device->paint.width - *x;
+            *x = point_temp;
+            break;
+        case E_PAPER_ROTATE_180:
+            *x = device->paint.width - *x;
+            *y = device->paint.height - *y;
+            break;
+        case E_PAPER_ROTATE_270:
+            point_temp = *y;
+            *y = *x;
+            *x = device->paint.height - point_temp;
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ *  @brief: this widens the dirty area by a box given in the current rotation
+ */
+static void iot_epaper_mark_dirty_area(epaper_dev_t* device, int x0, int y0, int x1, int y1)
+{
+    iot_epaper_rotate_point(device, &x0, &y0);
+    iot_epaper_rotate_point(device, &x1, &y1);
+    iot_epaper_mark_dirty(device, x0 < x1 ? x0 : x1, y0 < y1 ? y0 : y1,
+            x0 < x1 ? x1 : x0, y0 < y1 ? y1 : y0);
 }
 
+bool iot_epaper_get_dirty_area(epaper_handle_t dev, epaper_area_t* area)
+{
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    int x0, y0, x1, y1;
+    xSemaphoreTakeRecursive(device->paint_mux, portMAX_DELAY);
+    x0 = device->paint.dirty.x0;
+    y0 = device->paint.dirty.y0;
+    x1 = device->paint.dirty.x1;
+    y1 = device->paint.dirty.y1;
+    if (x0 > x1 || y0 > y1) {
+        xSemaphoreGiveRecursive(device->paint_mux);
+        return false;
+    }
+    // the area is kept in panel coordinates, mapped with the rotation it is read with
+    iot_epaper_unrotate_point(device, &x0, &y0);
+    iot_epaper_unrotate_point(device, &x1, &y1);
+    xSemaphoreGiveRecursive(device->paint_mux);
+    area->x0 = x0 < x1 ? x0 : x1;
+    area->y0 = y0 < y1 ? y0 : y1;
+    area->x1 = x0 < x1 ? x1 : x0;
+    area->y1 = y0 < y1 ? y1 : y0;
+    return true;
+}
 
+void iot_epaper_reset_dirty_area(epaper_handle_t dev)
+{
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    xSemaphoreTakeRecursive(device->paint_mux, portMAX_DELAY);
+    device->paint.dirty.x0 = INT_MAX;
+    device->paint.dirty.y0 = INT_MAX;
+    device->paint.dirty.x1 = -1;
+    device->paint.dirty.y1 = -1;
+    xSemaphoreGiveRecursive(device->paint_mux);
+}
 
 /**
  *  @brief: this draws a pixel by absolute coordinates.
  *          this function won't be affected by the rotate parameter.
+ *          The caller holds paint_mux.
  */
 static void iot_epaper_draw_absolute_pixel(epaper_handle_t dev, int x, int y, int color)
 {
@@ -265,7 +793,15 @@ static void iot_epaper_draw_absolute_pixel(epaper_handle_t dev, int x, int y, in
     if (x < 0 || x >= device->paint.width || y < 0 || y >= device->paint.height) {
         return;
     }
-    EPAPER_ENTER_CRITICAL(&epaper_spinlock);
+    if (device->paint.r_image == NULL) {
+        // B/W only, red is white on the B/W RAM
+        if (color == BLACK) {
+            device->paint.bw_image[(x + y * device->paint.width) / 8] &= ~(0x80 >> (x % 8));
+        } else if (color == WHITE || color == RED) {
+            device->paint.bw_image[(x + y * device->paint.width) / 8] |= 0x80 >> (x % 8);
+        }
+        return;
+    }
 	switch (color) {
 	
 		case WHITE:
@@ -283,21 +819,91 @@ static void iot_epaper_draw_absolute_pixel(epaper_handle_t dev, int x, int y, in
 		default:
 			break;
 	}
-		
-    
-	EPAPER_EXIT_CRITICAL(&epaper_spinlock);
+}
+
+/**
+ *  @brief: this fills a whole frame plane with one byte value,
+ *          using 32-bit word stores for the aligned part of the plane.
+ */
+static void iot_epaper_fill_plane(unsigned char* plane, uint8_t value, int size)
+{
+    uint32_t word = value * 0x01010101UL;
+    uint32_t* p_word;
+    int i = 0;
+    /* the planes come from heap_caps_malloc and are word aligned,
+     * but do not rely on it */
+    while (i < size && ((uintptr_t) &plane[i] & 3)) {
+        plane[i++] = value;
+    }
+    p_word = (uint32_t*) &plane[i];
+    for (; i + 4 <= size; i += 4) {
+        *p_word++ = word;
+    }
+    while (i < size) {
+        plane[i++] = value;
+    }
+}
+
+/**
+ *  @brief: this paints the pixels selected by mask in one byte of both planes.
+ *          The caller holds paint_mux.
+ */
+static inline void iot_epaper_paint_byte(epaper_dev_t* device, int index, uint8_t mask, int color)
+{
+    if (device->paint.r_image == NULL) {
+        if (color == BLACK) {
+            device->paint.bw_image[index] &= ~mask;
+        } else if (color == WHITE || color == RED) {
+            device->paint.bw_image[index] |= mask;
+        }
+        return;
+    }
+    switch (color) {
+        case WHITE:
+            device->paint.bw_image[index] |= mask;
+            device->paint.r_image[index] &= ~mask;
+            break;
+        case BLACK:
+            device->paint.bw_image[index] &= ~mask;
+            device->paint.r_image[index] &= ~mask;
+            break;
+        case RED:
+            device->paint.bw_image[index] |= mask;
+            device->paint.r_image[index] |= mask;
+            break;
+        default:
+            break;
+    }
 }
 
 void iot_epaper_clean_paint(epaper_handle_t dev, int color)
 {
     epaper_dev_t* device = (epaper_dev_t*) dev;
-    xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
-    for (int x = 0; x < device->paint.width; x++) {
-        for (int y = 0; y < device->paint.height; y++) {
-            iot_epaper_draw_absolute_pixel(dev, x, y, color);
-        }
+    int size = device->paint.width * device->paint.height / 8;
+    uint8_t bw_value, r_value;
+    switch (color) {
+        case WHITE:
+            bw_value = 0xFF;
+            r_value = 0x00;
+            break;
+        case BLACK:
+            bw_value = 0x00;
+            r_value = 0x00;
+            break;
+        case RED:
+            bw_value = 0xFF;
+            r_value = 0xFF;
+            break;
+        default:
+            return;
     }
-    xSemaphoreGiveRecursive(device->spi_mux);
+    iot_epaper_render_begin(device);
+    iot_epaper_fill_plane(device->paint.bw_image, bw_value, size);
+    if (device->paint.r_image) {
+        iot_epaper_fill_plane(device->paint.r_image, r_value, size);
+    }
+    iot_epaper_mark_dirty(device, 0, 0, device->paint.width - 1, device->paint.height - 1);
+    iot_epaper_render_end(device);
 }
 
 /**
@@ -309,7 +915,7 @@ void iot_epaper_draw_string(epaper_handle_t dev, int x, int y, const char* text,
     unsigned int counter = 0;
     int refcolumn = x;
     epaper_dev_t* device = (epaper_dev_t*) dev;
-    xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
+    iot_epaper_render_begin(device);
     /* Send the string character by character on EPD */
     while (*p_text != 0) {
         /* Display one character on EPD */
@@ -320,16 +926,17 @@ void iot_epaper_draw_string(epaper_handle_t dev, int x, int y, const char* text,
         p_text++;
         counter++;
     }
-    xSemaphoreGiveRecursive(device->spi_mux);
+    iot_epaper_render_end(device);
 }
 
 /**
- *  @brief: this draws a pixel by the coordinates
+ *  @brief: this draws a pixel by the coordinates, without touching the dirty area.
+ *          Callers mark the bounding box of what they draw once.
  */
-void iot_epaper_draw_pixel(epaper_handle_t dev, int x, int y, int colored)
+static void iot_epaper_set_pixel(epaper_dev_t* device, int x, int y, int colored)
 {
     int point_temp;
-    epaper_dev_t* device = (epaper_dev_t*) dev;
+    epaper_handle_t dev = (epaper_handle_t) device;
     if (device->paint.rotate == E_PAPER_ROTATE_0) {
         if (x < 0 || x >= device->paint.width || y < 0 || y >= device->paint.height) {
             return;
@@ -362,91 +969,380 @@ void iot_epaper_draw_pixel(epaper_handle_t dev, int x, int y, int colored)
 }
 
 /**
- *  @brief: this draws a character on the frame buffer but not refresh
+ *  @brief: this draws a pixel by the coordinates
  */
-void iot_epaper_draw_char(epaper_handle_t dev, int x, int y, char ascii_char, epaper_font_t* font, int colored)
+void iot_epaper_draw_pixel(epaper_handle_t dev, int x, int y, int colored)
 {
-    int i, j;
-    unsigned int char_offset = (ascii_char - ' ') * font->height * (font->width / 8 + (font->width % 8 ? 1 : 0));
-    const unsigned char* ptr = &font->font_table[char_offset];
     epaper_dev_t* device = (epaper_dev_t*) dev;
-    xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
-    for (j = 0; j < font->height; j++) {
-        for (i = 0; i < font->width; i++) {
-            if (*ptr & (0x80 >> (i % 8))) {
-                iot_epaper_draw_pixel(dev, x + i, y + j, colored);
-            }
-            if (i % 8 == 7) {
-                ptr++;
-            }
-        }
-        if (font->width % 8 != 0) {
-            ptr++;
-        }
-    }
-    xSemaphoreGiveRecursive(device->spi_mux);
+    iot_epaper_render_begin(device);
+    iot_epaper_set_pixel(device, x, y, colored);
+    iot_epaper_mark_dirty_area(device, x, y, x, y);
+    iot_epaper_render_end(device);
 }
 
 /**
- *  @brief: this draws a line on the frame buffer
+ *  @brief: this transposes an 8x8 bit block, rows[0..7] are the rows of the block,
+ *          MSB first. On return cols[c] holds column c with row k in bit k.
+ *          (Hacker's Delight, transpose8rS32, rows taken bottom up)
  */
- //For horizontal or vertical lines, dont use this function.
-void iot_epaper_draw_line(epaper_handle_t dev, int x0, int y0, int x1, int y1, int colored)
+static void iot_epaper_transpose8(const uint8_t rows[8], uint8_t cols[8])
 {
-    /* Bresenham algorithm */
-    int dx = x1 - x0 >= 0 ? x1 - x0 : x0 - x1;
-    int sx = x0 < x1 ? 1 : -1;
-    int dy = y1 - y0 <= 0 ? y1 - y0 : y0 - y1;
-    int sy = y0 < y1 ? 1 : -1;
-    int err = dx + dy;
-    epaper_dev_t* device = (epaper_dev_t*) dev;
-    xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
-    while ((x0 != x1) && (y0 != y1)) {
-        iot_epaper_draw_pixel(dev, x0, y0, colored);
-        if (2 * err >= dy) {
-            err += dy;
-            x0 += sx;
-        }
-        if (2 * err <= dx) {
-            err += dx;
-            y0 += sy;
-        }
-    }
-    xSemaphoreGiveRecursive(device->spi_mux);
+    uint32_t x, y, t;
+    x = ((uint32_t) rows[7] << 24) | ((uint32_t) rows[6] << 16) | ((uint32_t) rows[5] << 8) | rows[4];
+    y = ((uint32_t) rows[3] << 24) | ((uint32_t) rows[2] << 16) | ((uint32_t) rows[1] << 8) | rows[0];
+    t = (x ^ (x >> 7)) & 0x00AA00AA;  x = x ^ t ^ (t << 7);
+    t = (y ^ (y >> 7)) & 0x00AA00AA;  y = y ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC; x = x ^ t ^ (t << 14);
+    t = (y ^ (y >> 14)) & 0x0000CCCC; y = y ^ t ^ (t << 14);
+    t = (x & 0xF0F0F0F0) | ((y >> 4) & 0x0F0F0F0F);
+    y = ((x << 4) & 0xF0F0F0F0) | (y & 0x0F0F0F0F);
+    x = t;
+    cols[0] = x >> 24; cols[1] = x >> 16; cols[2] = x >> 8; cols[3] = x;
+    cols[4] = y >> 24; cols[5] = y >> 16; cols[6] = y >> 8; cols[7] = y;
 }
 
 /**
- *  @brief: this draws a horizontal line on the frame buffer
+ *  @brief: this copies a 1 bpp bitmap, rows MSB first and padded to whole bytes,
+ *          into the planes at absolute (x,y), a bitmap byte at a time.
+ *          The bitmap must lie entirely inside the frame buffer.
  */
-void iot_epaper_draw_horizontal_line(epaper_handle_t dev, int x, int y, int width, int colored)
+static void iot_epaper_blit_bitmap(epaper_dev_t* device, int x, int y, const unsigned char* ptr,
+        int width, int height, int colored)
 {
-    int i;
-    epaper_dev_t* device = (epaper_dev_t*) dev;
-    xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
-    for (i = x; i < x + width; i++) {
-        iot_epaper_draw_pixel(dev, i, y, colored);
+    int bytes_per_row = width / 8 + (width % 8 ? 1 : 0);
+    int stride = device->paint.width / 8;
+    int shift = x % 8;
+    uint8_t last_mask = width % 8 ? 0xFF << (8 - width % 8) : 0xFF;
+
+    for (int j = 0; j < height; j++) {
+        int index = (y + j) * stride + x / 8;
+        for (int k = 0; k < bytes_per_row; k++, ptr++, index++) {
+            uint8_t bits = k == bytes_per_row - 1 ? *ptr & last_mask : *ptr;
+            if (bits >> shift) {
+                iot_epaper_paint_byte(device, index, bits >> shift, colored);
+            }
+            if (shift && (uint8_t)(bits << (8 - shift))) {
+                iot_epaper_paint_byte(device, index + 1, bits << (8 - shift), colored);
+            }
+        }
     }
-    xSemaphoreGiveRecursive(device->spi_mux);
 }
 
 /**
- *  @brief: this draws a vertical line on the frame buffer
+ *  @brief: this copies a glyph rotated by 90 degrees into the planes, transposing
+ *          8x8 blocks of the font. Glyph row j lands on absolute column
+ *          width - (y + j), glyph column i on absolute row x + i.
+ *          The glyph must lie entirely inside the frame buffer.
  */
-void iot_epaper_draw_vertical_line(epaper_handle_t dev, int x, int y, int height, int colored)
+static void iot_epaper_blit_glyph_90(epaper_dev_t* device, int x, int y, const unsigned char* ptr,
+        epaper_font_t* font, int colored)
 {
-    int i;
-    epaper_dev_t* device = (epaper_dev_t*) dev;
-    xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
-    for (i = y; i < y + height; i++) {
-        iot_epaper_draw_pixel(dev, x, i, colored);
+    int bytes_per_row = font->width / 8 + (font->width % 8 ? 1 : 0);
+    int stride = device->paint.width / 8;
+    uint8_t rows[8];
+    uint8_t cols[8];
+
+    for (int j0 = 0; j0 < font->height; j0 += 8) {
+        int n = font->height - j0 < 8 ? font->height - j0 : 8;
+        int col_hi = device->paint.width - (y + j0);   // absolute column of glyph row j0
+        int shift = 7 - col_hi % 8;
+        int index_hi = col_hi / 8;
+        for (int k = 0; k < bytes_per_row; k++) {
+            for (int r = 0; r < 8; r++) {
+                rows[r] = r < n ? ptr[(j0 + r) * bytes_per_row + k] : 0;
+            }
+            iot_epaper_transpose8(rows, cols);
+            for (int c = 0; c < 8 && k * 8 + c < font->width; c++) {
+                /* rows j0..j0+7 go to columns col_hi down to col_hi - 7 */
+                uint16_t bits = cols[c] << shift;
+                int index = (x + k * 8 + c) * stride + index_hi;
+                if (bits & 0xFF) {
+                    iot_epaper_paint_byte(device, index, bits & 0xFF, colored);
+                }
+                if (bits >> 8) {
+                    iot_epaper_paint_byte(device, index - 1, bits >> 8, colored);
+                }
+            }
+        }
     }
-    xSemaphoreGiveRecursive(device->spi_mux);
 }
 
 /**
- *  @brief: this draws a rectangle
+ *  @brief: this returns the pre-rotated copy of a glyph, transposing it into the
+ *          cache on a miss. Returns NULL when the glyph does not fit the budget.
  */
-void iot_epaper_draw_rectangle(epaper_handle_t dev, int x0, int y0, int x1, int y1, int colored)
+static epaper_glyph_t* iot_epaper_get_rotated_glyph(epaper_dev_t* device, const unsigned char* ptr,
+        epaper_font_t* font, char ascii_char)
+{
+    epaper_glyph_cache_stats_t* stats = &device->glyph_stats;
+    epaper_glyph_t** link = &device->glyph_cache;
+    epaper_glyph_t* glyph;
+    int bytes_per_row = font->width / 8 + (font->width % 8 ? 1 : 0);
+    int rotated_bytes_per_row = font->height / 8 + (font->height % 8 ? 1 : 0);
+    size_t size = sizeof(epaper_glyph_t) + font->width * rotated_bytes_per_row;
+
+    for (glyph = *link; glyph; link = &glyph->next, glyph = glyph->next) {
+        if (glyph->font == font && glyph->ascii_char == ascii_char) {
+            /* move to front */
+            *link = glyph->next;
+            glyph->next = device->glyph_cache;
+            device->glyph_cache = glyph;
+            stats->hits++;
+            return glyph;
+        }
+    }
+    stats->misses++;
+    if (size > stats->budget) {
+        return NULL;
+    }
+    /* evict the least recently used glyphs until the new one fits */
+    while (stats->used + size > stats->budget) {
+        for (link = &device->glyph_cache; (*link)->next; link = &(*link)->next) {
+        }
+        stats->used -= (*link)->size;
+        stats->glyphs--;
+        stats->evictions++;
+        free(*link);
+        *link = NULL;
+    }
+    glyph = (epaper_glyph_t*) calloc(1, size);
+    if (glyph == NULL) {
+        return NULL;
+    }
+    glyph->font = font;
+    glyph->ascii_char = ascii_char;
+    glyph->size = size;
+    for (int j = 0; j < font->height; j++) {
+        int p = font->height - 1 - j;   // bit position of glyph row j in a rotated row
+        for (int i = 0; i < font->width; i++) {
+            if (ptr[j * bytes_per_row + i / 8] & (0x80 >> (i % 8))) {
+                glyph->bits[i * rotated_bytes_per_row + p / 8] |= 0x80 >> (p % 8);
+            }
+        }
+    }
+    glyph->next = device->glyph_cache;
+    device->glyph_cache = glyph;
+    stats->used += size;
+    stats->glyphs++;
+    return glyph;
+}
+
+esp_err_t iot_epaper_set_glyph_cache(epaper_handle_t dev, size_t budget)
+{
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    xSemaphoreTakeRecursive(device->paint_mux, portMAX_DELAY);
+    iot_epaper_free_glyph_cache(device);
+    memset(&device->glyph_stats, 0, sizeof(device->glyph_stats));
+    device->glyph_stats.budget = budget;
+    xSemaphoreGiveRecursive(device->paint_mux);
+    return ESP_OK;
+}
+
+void iot_epaper_get_glyph_cache_stats(epaper_handle_t dev, epaper_glyph_cache_stats_t* stats)
+{
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    xSemaphoreTakeRecursive(device->paint_mux, portMAX_DELAY);
+    *stats = device->glyph_stats;
+    xSemaphoreGiveRecursive(device->paint_mux);
+}
+
+/**
+ *  @brief: this draws a character on the frame buffer but not refresh
+ */
+void iot_epaper_draw_char(epaper_handle_t dev, int x, int y, char ascii_char, epaper_font_t* font, int colored)
+{
+    int i, j;
+    unsigned int char_offset = (ascii_char - ' ') * font->height * (font->width / 8 + (font->width % 8 ? 1 : 0));
+    const unsigned char* ptr = &font->font_table[char_offset];
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    iot_epaper_render_begin(device);
+    if (device->paint.rotate == E_PAPER_ROTATE_0 &&
+            x >= 0 && x + font->width <= device->paint.width &&
+            y >= 0 && y + font->height <= device->paint.height) {
+        iot_epaper_blit_bitmap(device, x, y, ptr, font->width, font->height, colored);
+    } else if (device->paint.rotate == E_PAPER_ROTATE_90 &&
+            x >= 0 && x + font->width <= device->paint.height &&
+            /* glyph rows at y = 0 would land on column width, outside the frame */
+            y >= 1 && y + font->height <= device->paint.width) {
+        epaper_glyph_t* glyph = device->glyph_stats.budget ?
+                iot_epaper_get_rotated_glyph(device, ptr, font, ascii_char) : NULL;
+        if (glyph) {
+            /* the last glyph row lands on the leftmost column */
+            iot_epaper_blit_bitmap(device, device->paint.width - (y + font->height - 1), x,
+                    glyph->bits, font->height, font->width, colored);
+        } else {
+            iot_epaper_blit_glyph_90(device, x, y, ptr, font, colored);
+        }
+    } else {
+        /* clipped glyphs and the other rotations go pixel by pixel */
+        for (j = 0; j < font->height; j++) {
+            for (i = 0; i < font->width; i++) {
+                if (*ptr & (0x80 >> (i % 8))) {
+                    iot_epaper_set_pixel(device, x + i, y + j, colored);
+                }
+                if (i % 8 == 7) {
+                    ptr++;
+                }
+            }
+            if (font->width % 8 != 0) {
+                ptr++;
+            }
+        }
+    }
+    iot_epaper_mark_dirty_area(device, x, y, x + font->width - 1, y + font->height - 1);
+    iot_epaper_render_end(device);
+}
+
+/**
+ *  @brief: this draws a line on the frame buffer
+ */
+ //For horizontal or vertical lines, dont use this function.
+void iot_epaper_draw_line(epaper_handle_t dev, int x0, int y0, int x1, int y1, int colored)
+{
+    /* Bresenham algorithm */
+    int dx = x1 - x0 >= 0 ? x1 - x0 : x0 - x1;
+    int sx = x0 < x1 ? 1 : -1;
+    int dy = y1 - y0 <= 0 ? y1 - y0 : y0 - y1;
+    int sy = y0 < y1 ? 1 : -1;
+    int err = dx + dy;
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    iot_epaper_render_begin(device);
+    iot_epaper_mark_dirty_area(device, x0, y0, x1, y1);
+    while ((x0 != x1) && (y0 != y1)) {
+        iot_epaper_set_pixel(device, x0, y0, colored);
+        if (2 * err >= dy) {
+            err += dy;
+            x0 += sx;
+        }
+        if (2 * err <= dx) {
+            err += dx;
+            y0 += sy;
+        }
+    }
+    iot_epaper_render_end(device);
+}
+
+/**
+ *  @brief: this fills the absolute box (x0,y0)-(x1,y1), already clipped to the
+ *          frame buffer, a row at a time: masked edge bytes and whole bytes in
+ *          between. Boxes made of whole rows are filled as one block.
+ */
+static void iot_epaper_fill_abs_rect(epaper_dev_t* device, int x0, int y0, int x1, int y1, int colored)
+{
+    int stride = device->paint.width / 8;
+    int first = x0 / 8;
+    int last = x1 / 8;
+    uint8_t first_mask = 0xFF >> (x0 % 8);
+    uint8_t last_mask = 0xFF << (7 - x1 % 8);
+    uint8_t bw_value, r_value;
+
+    switch (colored) {
+        case WHITE:
+            bw_value = 0xFF;
+            r_value = 0x00;
+            break;
+        case BLACK:
+            bw_value = 0x00;
+            r_value = 0x00;
+            break;
+        case RED:
+            bw_value = 0xFF;
+            r_value = 0xFF;
+            break;
+        default:
+            return;
+    }
+    if (first_mask == 0xFF && last_mask == 0xFF && last - first + 1 == stride) {
+        iot_epaper_fill_plane(&device->paint.bw_image[y0 * stride], bw_value, stride * (y1 - y0 + 1));
+        if (device->paint.r_image) {
+            iot_epaper_fill_plane(&device->paint.r_image[y0 * stride], r_value, stride * (y1 - y0 + 1));
+        }
+        return;
+    }
+    if (first == last) {
+        first_mask &= last_mask;
+    }
+    for (int y = y0; y <= y1; y++) {
+        int row = y * stride;
+        iot_epaper_paint_byte(device, row + first, first_mask, colored);
+        if (last > first) {
+            memset(&device->paint.bw_image[row + first + 1], bw_value, last - first - 1);
+            if (device->paint.r_image) {
+                memset(&device->paint.r_image[row + first + 1], r_value, last - first - 1);
+            }
+            iot_epaper_paint_byte(device, row + last, last_mask, colored);
+        }
+    }
+}
+
+/**
+ *  @brief: this fills the box (x0,y0)-(x1,y1) given in the current rotation,
+ *          with x0 <= x1 and y0 <= y1, and marks it dirty. Pixels are clipped
+ *          exactly like iot_epaper_draw_pixel() clips them.
+ */
+static void iot_epaper_fill_rect(epaper_dev_t* device, int x0, int y0, int x1, int y1, int colored)
+{
+    bool swapped = device->paint.rotate == E_PAPER_ROTATE_90 || device->paint.rotate == E_PAPER_ROTATE_270;
+    int max_x = swapped ? device->paint.height - 1 : device->paint.width - 1;
+    int max_y = swapped ? device->paint.width - 1 : device->paint.height - 1;
+    int temp;
+
+    x0 = x0 < 0 ? 0 : x0;
+    y0 = y0 < 0 ? 0 : y0;
+    x1 = x1 > max_x ? max_x : x1;
+    y1 = y1 > max_y ? max_y : y1;
+    if (x0 > x1 || y0 > y1) {
+        return;
+    }
+    iot_epaper_rotate_point(device, &x0, &y0);
+    iot_epaper_rotate_point(device, &x1, &y1);
+    if (x0 > x1) {
+        temp = x0;
+        x0 = x1;
+        x1 = temp;
+    }
+    if (y0 > y1) {
+        temp = y0;
+        y0 = y1;
+        y1 = temp;
+    }
+    x0 = x0 < 0 ? 0 : x0;
+    y0 = y0 < 0 ? 0 : y0;
+    x1 = x1 >= device->paint.width ? device->paint.width - 1 : x1;
+    y1 = y1 >= device->paint.height ? device->paint.height - 1 : y1;
+    if (x0 > x1 || y0 > y1) {
+        return;
+    }
+    iot_epaper_fill_abs_rect(device, x0, y0, x1, y1, colored);
+    iot_epaper_mark_dirty(device, x0, y0, x1, y1);
+}
+
+/**
+ *  @brief: this draws a horizontal line on the frame buffer
+ */
+void iot_epaper_draw_horizontal_line(epaper_handle_t dev, int x, int y, int width, int colored)
+{
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    iot_epaper_render_begin(device);
+    iot_epaper_fill_rect(device, x, y, x + width - 1, y, colored);
+    iot_epaper_render_end(device);
+}
+
+/**
+ *  @brief: this draws a vertical line on the frame buffer
+ */
+void iot_epaper_draw_vertical_line(epaper_handle_t dev, int x, int y, int height, int colored)
+{
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    iot_epaper_render_begin(device);
+    iot_epaper_fill_rect(device, x, y, x, y + height - 1, colored);
+    iot_epaper_render_end(device);
+}
+
+/**
+ *  @brief: this draws a rectangle
+ */
+void iot_epaper_draw_rectangle(epaper_handle_t dev, int x0, int y0, int x1, int y1, int colored)
 {
     int min_x, min_y, max_x, max_y;
     min_x = x1 > x0 ? x0 : x1;
@@ -454,12 +1350,12 @@ void iot_epaper_draw_rectangle(epaper_handle_t dev, int x0, int y0, int x1, int
     min_y = y1 > y0 ? y0 : y1;
     max_y = y1 > y0 ? y1 : y0;
     epaper_dev_t* device = (epaper_dev_t*) dev;
-    xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
+    iot_epaper_render_begin(device);
     iot_epaper_draw_horizontal_line(dev, min_x, min_y, max_x - min_x + 1, colored);
     iot_epaper_draw_horizontal_line(dev, min_x, max_y, max_x - min_x + 1, colored);
     iot_epaper_draw_vertical_line(dev, min_x, min_y, max_y - min_y + 1, colored);
     iot_epaper_draw_vertical_line(dev, max_x, min_y, max_y - min_y + 1, colored);
-    xSemaphoreGiveRecursive(device->spi_mux);
+    iot_epaper_render_end(device);
 }
 
 /**
@@ -468,17 +1364,14 @@ void iot_epaper_draw_rectangle(epaper_handle_t dev, int x0, int y0, int x1, int
 void iot_epaper_draw_filled_rectangle(epaper_handle_t dev, int x0, int y0, int x1, int y1, int colored)
 {
     int min_x, min_y, max_x, max_y;
-    int i;
     min_x = x1 > x0 ? x0 : x1;
     max_x = x1 > x0 ? x1 : x0;
     min_y = y1 > y0 ? y0 : y1;
     max_y = y1 > y0 ? y1 : y0;
     epaper_dev_t* device = (epaper_dev_t*) dev;
-    xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
-    for (i = min_x; i <= max_x; i++) {
-        iot_epaper_draw_vertical_line(dev, i, min_y, max_y - min_y + 1, colored);
-    }
-    xSemaphoreGiveRecursive(device->spi_mux);
+    iot_epaper_render_begin(device);
+    iot_epaper_fill_rect(device, min_x, min_y, max_x, max_y, colored);
+    iot_epaper_render_end(device);
 }
 
 /**
@@ -493,12 +1386,13 @@ void iot_epaper_draw_circle(epaper_handle_t dev, int x, int y, int radius,
     int err = 2 - 2 * radius;
     int e2;
     epaper_dev_t* device = (epaper_dev_t*) dev;
-    xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
+    iot_epaper_render_begin(device);
+    iot_epaper_mark_dirty_area(device, x - radius, y - radius, x + radius, y + radius);
     do {
-        iot_epaper_draw_pixel(dev, x - x_pos, y + y_pos, colored);
-        iot_epaper_draw_pixel(dev, x + x_pos, y + y_pos, colored);
-        iot_epaper_draw_pixel(dev, x + x_pos, y - y_pos, colored);
-        iot_epaper_draw_pixel(dev, x - x_pos, y - y_pos, colored);
+        iot_epaper_set_pixel(device, x - x_pos, y + y_pos, colored);
+        iot_epaper_set_pixel(device, x + x_pos, y + y_pos, colored);
+        iot_epaper_set_pixel(device, x + x_pos, y - y_pos, colored);
+        iot_epaper_set_pixel(device, x - x_pos, y - y_pos, colored);
         e2 = err;
         if (e2 <= y_pos) {
             err += ++y_pos * 2 + 1;
@@ -510,28 +1404,45 @@ void iot_epaper_draw_circle(epaper_handle_t dev, int x, int y, int radius,
             err += ++x_pos * 2 + 1;
         }
     } while (x_pos <= 0);
-    xSemaphoreGiveRecursive(device->spi_mux);
+    iot_epaper_render_end(device);
 }
 
 /**
- *  @brief: this draws a filled circle
+ *  @brief: this draws a filled circle, one span per scanline
  */
 void iot_epaper_draw_filled_circle(epaper_handle_t dev, int x, int y, int radius, int colored)
 {
-    /* Bresenham algorithm */
+    /* Bresenham algorithm, walking from the widest row outwards: the first
+     * step on each row has the widest span, so only that one is drawn */
     int x_pos = -radius;
     int y_pos = 0;
     int err = 2 - 2 * radius;
     int e2;
+    int last_y_pos = -1;
+    bool columns;
     epaper_dev_t* device = (epaper_dev_t*) dev;
-    xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
+    if (radius < 0) {
+        return;
+    }
+    iot_epaper_render_begin(device);
+    /* The filled shape is symmetric about its diagonal, so its columns have the
+     * same spans as its rows. When rotated by 90 or 270 degrees the columns are
+     * the panel rows, and filling those runs whole bytes at a time. */
+    columns = device->paint.rotate == E_PAPER_ROTATE_90 || device->paint.rotate == E_PAPER_ROTATE_270;
     do {
-        iot_epaper_draw_pixel(dev, x - x_pos, y + y_pos, colored);
-        iot_epaper_draw_pixel(dev, x + x_pos, y + y_pos, colored);
-        iot_epaper_draw_pixel(dev, x + x_pos, y - y_pos, colored);
-        iot_epaper_draw_pixel(dev, x - x_pos, y - y_pos, colored);
-        iot_epaper_draw_horizontal_line(dev, x + x_pos, y + y_pos, 2 * (-x_pos) + 1, colored);
-        iot_epaper_draw_horizontal_line(dev, x + x_pos, y - y_pos, 2 * (-x_pos) + 1, colored);
+        if (y_pos != last_y_pos) {
+            if (columns) {
+                iot_epaper_fill_rect(device, x + y_pos, y + x_pos, x + y_pos, y - x_pos, colored);
+            } else {
+                iot_epaper_fill_rect(device, x + x_pos, y + y_pos, x - x_pos, y + y_pos, colored);
+            }
+            if (y_pos && columns) {
+                iot_epaper_fill_rect(device, x - y_pos, y + x_pos, x - y_pos, y - x_pos, colored);
+            } else if (y_pos) {
+                iot_epaper_fill_rect(device, x + x_pos, y - y_pos, x - x_pos, y - y_pos, colored);
+            }
+            last_y_pos = y_pos;
+        }
         e2 = err;
         if (e2 <= y_pos) {
             err += ++y_pos * 2 + 1;
@@ -543,15 +1454,206 @@ void iot_epaper_draw_filled_circle(epaper_handle_t dev, int x, int y, int radius
             err += ++x_pos * 2 + 1;
         }
     } while (x_pos <= 0);
-    xSemaphoreGiveRecursive(device->spi_mux);
+    iot_epaper_render_end(device);
 }
 
-void iot_epaper_wait_idle(epaper_handle_t dev)
+/**
+ *  @brief: this draws a filled ellipse, one span per scanline
+ */
+void iot_epaper_draw_filled_ellipse(epaper_handle_t dev, int x, int y, int x_radius, int y_radius, int colored)
 {
+    /* a point (dx,dy) is inside when dx^2 * ry^2 + dy^2 * rx^2 <= rx^2 * ry^2,
+     * the span half width only shrinks as dy grows (and the other way round) */
+    int64_t rx2 = (int64_t) x_radius * x_radius;
+    int64_t ry2 = (int64_t) y_radius * y_radius;
+    int64_t limit = rx2 * ry2;
+    int dx = x_radius;
+    int dy = y_radius;
     epaper_dev_t* device = (epaper_dev_t*) dev;
-    while (gpio_get_level((gpio_num_t) device->pin.busy_pin) == device->pin.busy_active_level) {
-        vTaskDelay(10 / portTICK_RATE_MS);
+    if (x_radius < 0 || y_radius < 0) {
+        return;
+    }
+    iot_epaper_render_begin(device);
+    if (device->paint.rotate == E_PAPER_ROTATE_90 || device->paint.rotate == E_PAPER_ROTATE_270) {
+        /* columns are the panel rows, see iot_epaper_draw_filled_circle() */
+        for (dx = 0; dx <= x_radius; dx++) {
+            while (dy > 0 && dx * dx * ry2 + dy * dy * rx2 > limit) {
+                dy--;
+            }
+            iot_epaper_fill_rect(device, x + dx, y - dy, x + dx, y + dy, colored);
+            if (dx) {
+                iot_epaper_fill_rect(device, x - dx, y - dy, x - dx, y + dy, colored);
+            }
+        }
+    } else {
+        for (dy = 0; dy <= y_radius; dy++) {
+            while (dx > 0 && dx * dx * ry2 + dy * dy * rx2 > limit) {
+                dx--;
+            }
+            iot_epaper_fill_rect(device, x - dx, y + dy, x + dx, y + dy, colored);
+            if (dy) {
+                iot_epaper_fill_rect(device, x - dx, y - dy, x + dx, y - dy, colored);
+            }
+        }
+    }
+    iot_epaper_render_end(device);
+}
+
+static void IRAM_ATTR iot_epaper_busy_isr(void* arg)
+{
+    epaper_dev_t* device = (epaper_dev_t*) arg;
+    BaseType_t woken = pdFALSE;
+    portENTER_CRITICAL_ISR(&device->stats_lock);
+    device->busy_edge_us = esp_timer_get_time();
+    portEXIT_CRITICAL_ISR(&device->stats_lock);
+    xSemaphoreGiveFromISR(device->busy_sem, &woken);
+    if (woken == pdTRUE) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+/**
+ *  @brief: this sets up the busy pin interrupt, on the edge to the idle level
+ */
+static void iot_epaper_busy_isr_init(epaper_dev_t* device)
+{
+    esp_err_t ret;
+    int busy_pin = device->pin.busy_pin;
+
+    device->busy_sem = xSemaphoreCreateBinary();
+    if (device->busy_sem == NULL) {
+        ESP_LOGW(TAG, "no memory for the busy pin semaphore, polling");
+        return;
+    }
+    gpio_set_intr_type(busy_pin, device->pin.busy_active_level ? GPIO_INTR_NEGEDGE : GPIO_INTR_POSEDGE);
+    ret = gpio_install_isr_service(0);
+    if (ret == ESP_OK || ret == ESP_ERR_INVALID_STATE) {  // may be installed by the application already
+        ret = gpio_isr_handler_add(busy_pin, iot_epaper_busy_isr, device);
+    }
+    if (ret == ESP_OK) {
+        gpio_intr_enable(busy_pin);
+        device->busy_isr = true;
+    } else {
+        ESP_LOGW(TAG, "busy pin interrupt not available (%d), polling", ret);
+    }
+}
+
+/**
+ *  @brief: this adds a wait to the counters, wake_us is -1 when the wait was
+ *          not ended by the interrupt
+ */
+static void iot_epaper_add_busy_time(epaper_busy_stats_t* stats, uint32_t us, int64_t wake_us, esp_err_t ret)
+{
+    stats->count++;
+    stats->last_us = us;
+    stats->total_us += us;
+    if (us > stats->max_us) {
+        stats->max_us = us;
+    }
+    if (wake_us >= 0) {
+        stats->last_wake_us = (uint32_t) wake_us;
+        if (stats->last_wake_us > stats->max_wake_us) {
+            stats->max_wake_us = stats->last_wake_us;
+        }
+    }
+    if (ret != ESP_OK) {
+        stats->timeouts++;
+    }
+}
+
+/**
+ *  @brief: this waits for the busy pin to go idle and records how long it took
+ *          in the counters of op. Gives up after EPAPER_BUSY_TIMEOUT_MS.
+ */
+static esp_err_t iot_epaper_wait_busy(epaper_dev_t* device, epaper_busy_op_t op)
+{
+    gpio_num_t busy_pin = (gpio_num_t) device->pin.busy_pin;
+    TickType_t start = xTaskGetTickCount();
+    TickType_t timeout = pdMS_TO_TICKS(EPAPER_BUSY_TIMEOUT_MS);
+    int64_t t0 = esp_timer_get_time();
+    esp_err_t ret = ESP_OK;
+    int64_t wake_us = -1;
+    uint32_t us;
+
+    // drop an edge left over from a wait that saw the pin idle first
+    if (device->busy_isr) {
+        xSemaphoreTake(device->busy_sem, 0);
+    }
+    while (gpio_get_level(busy_pin) == device->pin.busy_active_level) {
+        TickType_t waited = xTaskGetTickCount() - start;
+        if (waited >= timeout) {
+            ret = ESP_ERR_TIMEOUT;
+            break;
+        }
+        if (device->busy_isr) {
+            // bounded, the pin is read again should another waiter take the edge
+            TickType_t slice = pdMS_TO_TICKS(EPAPER_BUSY_RECHECK_MS);
+            if (xSemaphoreTake(device->busy_sem, timeout - waited < slice ? timeout - waited : slice) == pdTRUE) {
+                portENTER_CRITICAL(&device->stats_lock);
+                wake_us = esp_timer_get_time() - device->busy_edge_us;
+                portEXIT_CRITICAL(&device->stats_lock);
+            }
+        } else {
+            vTaskDelay(10 / portTICK_RATE_MS);
+        }
+    }
+
+    us = (uint32_t) (esp_timer_get_time() - t0);
+    portENTER_CRITICAL(&device->stats_lock);
+    device->stats.wait_idle_us += us;
+    if (op == E_PAPER_BUSY_REFRESH) {
+        if (device->refresh_fast) {
+            device->stats.fast_refreshes++;
+        } else {
+            device->stats.full_refreshes++;
+        }
+        device->stats.last_refresh_us = (uint32_t) (t0 + us - device->refresh_start_us);
+    }
+    iot_epaper_add_busy_time(&device->busy_stats[op], us, wake_us, ret);
+    if (op == E_PAPER_BUSY_REFRESH && device->lut_refresh != EPAPER_LUT_NONE) {
+        iot_epaper_add_busy_time(&device->luts[device->lut_refresh].refresh, us, wake_us, ret);
     }
+    portEXIT_CRITICAL(&device->stats_lock);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "busy timeout, op %d", op);
+    } else {
+        ESP_LOGD(TAG, "busy op %d took %u us", op, us);
+    }
+    return ret;
+}
+
+void iot_epaper_wait_idle(epaper_handle_t dev)
+{
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    // a frame in flight is waited for by its own task first, one waiter per edge
+    xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
+    iot_epaper_wait_busy(device, E_PAPER_BUSY_OTHER);
+    xSemaphoreGiveRecursive(device->spi_mux);
+}
+
+void iot_epaper_get_busy_stats(epaper_handle_t dev, epaper_busy_op_t op, epaper_busy_stats_t* stats)
+{
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    portENTER_CRITICAL(&device->stats_lock);
+    *stats = device->busy_stats[op];
+    portEXIT_CRITICAL(&device->stats_lock);
+}
+
+void iot_epaper_get_stats(epaper_handle_t dev, epaper_stats_t* stats)
+{
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    portENTER_CRITICAL(&device->stats_lock);
+    *stats = device->stats;
+    portEXIT_CRITICAL(&device->stats_lock);
+}
+
+static uint32_t iot_epaper_get_spi_transactions(epaper_dev_t* device)
+{
+    uint32_t count;
+    portENTER_CRITICAL(&device->stats_lock);
+    count = device->stats.spi_transactions;
+    portEXIT_CRITICAL(&device->stats_lock);
+    return count;
 }
 
 void iot_epaper_reset(epaper_handle_t dev)
@@ -563,193 +1665,1032 @@ void iot_epaper_reset(epaper_handle_t dev)
     gpio_set_level((gpio_num_t) device->pin.reset_pin, (device->pin.rst_active_level) & 0x1);             //module reset
     ets_delay_us(200);
     gpio_set_level((gpio_num_t) device->pin.reset_pin, (~(device->pin.rst_active_level)) & 0x1);
-    iot_epaper_wait_idle(dev);
+    device->lut_loaded = EPAPER_LUT_NONE;
+    device->row_hash_valid = false;
+    iot_epaper_wait_busy(device, E_PAPER_BUSY_RESET);
     xSemaphoreGiveRecursive(device->spi_mux);
 }
 
-/* This function has been exposed to implement partial updates of the image
- * To Do: implement partial updates of the image
+/**
+ *  @brief: this queues the controller RAM window written by E_PAPER_WRITE_RAM,
+ *          x_start and x_end are rounded down to byte boundaries (8 pixels per byte)
+ */
+static void iot_epaper_queue_ram_area(epaper_dev_t* device, int* count, int x_start, int y_start, int x_end, int y_end)
+{
+    uint8_t x[2] = { x_start >> 3, x_end >> 3 };    // 8 pixels per byte
+    uint8_t y[4] = { y_start & 0xff, y_start >> 8, y_end & 0xff, y_end >> 8 };
+    iot_epaper_queue_command(device, count, E_PAPER_SET_RAM_X_ADDRESS_START_END_POSITION, x, sizeof(x));
+    iot_epaper_queue_command(device, count, E_PAPER_SET_RAM_Y_ADDRESS_START_END_POSITION, y, sizeof(y));
+}
+
+/**
+ *  @brief: this queues the controller RAM address the next E_PAPER_WRITE_RAM data goes to
+ */
+static void iot_epaper_queue_ram_address_counter(epaper_dev_t* device, int* count, int x, int y)
+{
+    uint8_t y_counter[2] = { y & 0xff, y >> 8 };
+    iot_epaper_queue_command_byte(device, count, E_PAPER_SET_RAM_X_ADDRESS_COUNTER, x >> 3);  // 8 pixels per byte
+    iot_epaper_queue_command(device, count, E_PAPER_SET_RAM_Y_ADDRESS_COUNTER, y_counter, sizeof(y_counter));
+}
+
+/* Sets the controller RAM window written by E_PAPER_WRITE_RAM,
+ * x_start and x_end are rounded down to byte boundaries (8 pixels per byte)
  */
 void iot_set_ram_area(epaper_handle_t dev, int x_start, int y_start, int x_end, int y_end)
 {
-    iot_epaper_send_command(dev, E_PAPER_SET_RAM_X_ADDRESS_START_END_POSITION);
-    iot_epaper_send_byte(dev, x_start >> 3);  // 8 pixels per byte
-    iot_epaper_send_byte(dev, x_end   >> 3);  // 8 pixels per byte
-    iot_epaper_send_command(dev, E_PAPER_SET_RAM_Y_ADDRESS_START_END_POSITION);
-    iot_epaper_send_byte(dev, y_start & 0xff);
-    iot_epaper_send_byte(dev, y_start >> 8);
-    iot_epaper_send_byte(dev, y_end & 0xff);
-    iot_epaper_send_byte(dev, y_end   >> 8);
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    int count = 0;
+    xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
+    iot_epaper_queue_ram_area(device, &count, x_start, y_start, x_end, y_end);
+    iot_epaper_flush_trans(device, &count);
+    xSemaphoreGiveRecursive(device->spi_mux);
 }
 
-/* This function has been exposed to implement partial updates of the image
- * To Do: implement partial updates of the image
+/* Sets the controller RAM address the next E_PAPER_WRITE_RAM data goes to
  */
 void iot_set_ram_address_counter(epaper_handle_t dev, int x, int y)
 {
-    iot_epaper_send_command(dev, E_PAPER_SET_RAM_X_ADDRESS_COUNTER);
-    iot_epaper_send_byte(dev, x >> 3);  // 8 pixels per byte
-    iot_epaper_send_command(dev, E_PAPER_SET_RAM_Y_ADDRESS_COUNTER);
-    iot_epaper_send_byte(dev, y & 0xff);
-    iot_epaper_send_byte(dev, y >> 8);
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    int count = 0;
+    xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
+    iot_epaper_queue_ram_address_counter(device, &count, x, y);
+    iot_epaper_flush_trans(device, &count);
+    xSemaphoreGiveRecursive(device->spi_mux);
 }
 
-void iot_epaper_display_frame(epaper_handle_t dev)
+/**
+ *  @brief: this queues the window (x0,y0)-(x1,y1) of a frame plane, in absolute
+ *          coordinates with x0 and x1 + 1 on byte boundaries. Whole rows go out
+ *          straight from the plane, narrower windows are gathered in chunks.
+ */
+static void iot_epaper_queue_window(epaper_dev_t* device, int* count, const unsigned char* plane, int x0, int y0, int x1, int y1)
+{
+    uint32_t chunk[EPAPER_WINDOW_CHUNK_SIZE / 4];   // word aligned for DMA
+    int stride = device->paint.width / 8;
+    int row_bytes = (x1 - x0 + 1) / 8;
+    int rows_per_chunk = sizeof(chunk) / row_bytes;
+    int y = y0;
+
+    if (row_bytes == stride) {
+        iot_epaper_queue_data(device, count, &plane[y0 * stride], stride * (y1 - y0 + 1));
+        return;
+    }
+    while (y <= y1) {
+        uint8_t* p = (uint8_t*) chunk;
+        for (int r = 0; r < rows_per_chunk && y <= y1; r++, y++) {
+            memcpy(p, &plane[y * stride + x0 / 8], row_bytes);
+            p += row_bytes;
+        }
+        iot_epaper_queue_data(device, count, (uint8_t*) chunk, p - (uint8_t*) chunk);
+        // the chunk is refilled next
+        iot_epaper_flush_trans(device, count);
+    }
+}
+
+/**
+ *  @brief: this counts a refresh of the window (x0,y0)-(x1,y1) in the ghosting
+ *          regions. A fast refresh counts where the frame changed, a BWR
+ *          refresh clears them all.
+ */
+static void iot_epaper_count_ghosting(epaper_dev_t* device, const epaper_area_t* dirty, int x0, int y0, int x1, int y1)
+{
+    int tile_w = (device->paint.width + EPAPER_GHOST_COLS - 1) / EPAPER_GHOST_COLS;
+    int tile_h = (device->paint.height + EPAPER_GHOST_ROWS - 1) / EPAPER_GHOST_ROWS;
+
+    if (!device->pin.fast_bw_mode) {
+        // the BWR waveform drives the whole panel, whatever RAM window was written
+        memset(device->ghost_count, 0, sizeof(device->ghost_count));
+        return;
+    }
+    x0 = dirty->x0 > x0 ? dirty->x0 : x0;
+    y0 = dirty->y0 > y0 ? dirty->y0 : y0;
+    x1 = dirty->x1 < x1 ? dirty->x1 : x1;
+    y1 = dirty->y1 < y1 ? dirty->y1 : y1;
+    if (x0 > x1 || y0 > y1) {
+        return;     // nothing changed on screen
+    }
+    for (int r = y0 / tile_h; r <= y1 / tile_h; r++) {
+        for (int c = x0 / tile_w; c <= x1 / tile_w; c++) {
+            if (device->ghost_count[r][c] < UINT16_MAX) {
+                device->ghost_count[r][c]++;
+            }
+        }
+    }
+}
+
+/**
+ *  @brief: this writes the window (x0,y0)-(x1,y1) of the frame buffer to the
+ *          controller RAM and starts the display refresh. Coordinates are
+ *          absolute, x0 and x1 + 1 on byte boundaries. The whole sequence is
+ *          queued and waited for once. The frame is the device frame buffer or
+ *          a snapshot of the display service.
+ */
+static void iot_epaper_push_window(epaper_handle_t dev, const epaper_paint_t* frame, int x0, int y0, int x1, int y1)
 {
-	//TODO: implement updating the display from buffer. It will be used for displaying images.
     epaper_dev_t* device = (epaper_dev_t*) dev;
-   
-    xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
+    bool full = x0 == 0 && y0 == 0 && x1 == device->paint.width - 1 && y1 == device->paint.height - 1;
+    int count = 0;
+
+    device->refresh_start_us = esp_timer_get_time();
+    device->refresh_fast = device->pin.fast_bw_mode;
+    // the OTP waveform is used in BWR mode
+    device->lut_refresh = EPAPER_LUT_NONE;
+    if (device->pin.fast_bw_mode) {
+        iot_epaper_queue_lut(device, &count);
+        device->lut_refresh = device->lut_loaded;
+    }
 
 	// configure ePaper's memory to send data
-	
-	iot_set_ram_address_counter(dev, 0, 0);
+    if (!full) {
+        iot_epaper_queue_ram_area(device, &count, x0, y0, x1, y1);
+    }
+	iot_epaper_queue_ram_address_counter(device, &count, x0, y0);
 
     if (device->pin.fast_bw_mode) {
         //Updating B&W colors
-        iot_epaper_send_command(dev, 0x24);
-	    iot_epaper_send_data(dev, device->paint.bw_image, device->paint.width * device->paint.height / 8);
+        iot_epaper_queue_command(device, &count, 0x24, NULL, 0);
+        iot_epaper_queue_window(device, &count, frame->bw_image, x0, y0, x1, y1);
 
-        iot_epaper_send_command(dev, 0x22);   
-        iot_epaper_send_byte(dev, 0xC7);
-
-        // Refresh display
-        iot_epaper_send_command(dev, 0x20);
+        iot_epaper_queue_command_byte(device, &count, 0x22, 0xC7);
     } 
     else {
         //Updating B&W colors
-        iot_epaper_send_command(dev, 0x24);
-	    iot_epaper_send_data(dev, device->paint.bw_image, device->paint.width * device->paint.height / 8);
+        iot_epaper_queue_command(device, &count, 0x24, NULL, 0);
+        iot_epaper_queue_window(device, &count, frame->bw_image, x0, y0, x1, y1);
 
-        iot_epaper_send_command(dev, 0x22);   
-        iot_epaper_send_byte(dev, 0xC7);
+        iot_epaper_queue_command_byte(device, &count, 0x22, 0xC7);
         
         //Updating Red color
-        iot_epaper_send_command(dev, 0x26);
-        iot_epaper_send_data(dev, device->paint.r_image, device->paint.width * device->paint.height / 8);	
+        iot_epaper_queue_command(device, &count, 0x26, NULL, 0);
+        iot_epaper_queue_window(device, &count, frame->r_image, x0, y0, x1, y1);
 
-        iot_epaper_send_command(dev, 0x21);
-        iot_epaper_send_byte(dev, 0x00);
-        
-        // Refresh display
-        iot_epaper_send_command(dev, 0x20);
+        iot_epaper_queue_command_byte(device, &count, 0x21, 0x00);
     }
 
-	iot_epaper_wait_idle(dev);
+    // display_frame relies on the full window set up by iot_epaper_epd_init
+    if (!full) {
+        iot_epaper_queue_ram_area(device, &count, 0, 0, EPD_WIDTH-1, EPD_HEIGHT-1);
+    }
 
-    xSemaphoreGiveRecursive(device->spi_mux);
+    // Refresh display
+    iot_epaper_queue_command(device, &count, 0x20, NULL, 0);
+    iot_epaper_flush_trans(device, &count);
+    iot_epaper_count_ghosting(device, &frame->dirty, x0, y0, x1, y1);
+    // iot_epaper_push_frame sets it again when the rows are known
+    device->row_hash_valid = false;
 }
 
-void iot_epaper_sleep(epaper_handle_t dev)
+/**
+ *  @brief: this hashes a row of a plane, a word at a time. A change of a
+ *          single word always changes the hash.
+ */
+static uint32_t iot_epaper_row_hash(uint32_t hash, const unsigned char* row, int bytes)
 {
-    epaper_dev_t* device = (epaper_dev_t*) dev;
-    xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
-    iot_epaper_send_command(dev, E_PAPER_DEEP_SLEEP_MODE);
-    iot_epaper_wait_idle(dev);
-    xSemaphoreGiveRecursive(device->spi_mux);
-}
+    const uint32_t* words = (const uint32_t*) row;
+    int i;
 
-static void iot_epaper_epd_init(epaper_handle_t dev)
+    for (i = 0; i < bytes / 4; i++) {
+        hash = (hash ^ words[i]) * 16777619u;
+        hash ^= hash >> 15;
+    }
+    for (i *= 4; i < bytes; i++) {
+        hash = (hash ^ row[i]) * 16777619u;
+        hash ^= hash >> 15;
+    }
+    return hash;
+}
+
+/**
+ *  @brief: this pushes a whole frame, but writes only the rows that changed
+ *          since the last frame pushed. The refresh covers the whole panel
+ *          either way, the other rows are shown from the controller RAM.
+ */
+static void iot_epaper_push_frame(epaper_dev_t* device, const epaper_paint_t* frame)
+{
+    int stride = frame->width / 8;
+    int y0 = -1, y1 = -1;
+
+    if (device->row_hash == NULL) {
+        device->row_hash = (uint32_t*) malloc(frame->height * sizeof(uint32_t));
+        device->row_hash_valid = false;
+    }
+    if (device->row_hash == NULL) {
+        iot_epaper_push_window(device, frame, 0, 0, frame->width - 1, frame->height - 1);
+        return;
+    }
+    for (int y = 0; y < frame->height; y++) {
+        uint32_t hash = iot_epaper_row_hash(2166136261u, &frame->bw_image[y * stride], stride);
+        if (frame->r_image) {
+            hash = iot_epaper_row_hash(hash, &frame->r_image[y * stride], stride);
+        }
+        if (!device->row_hash_valid || hash != device->row_hash[y]) {
+            device->row_hash[y] = hash;
+            y0 = y0 < 0 ? y : y0;
+            y1 = y;
+        }
+    }
+    if (y0 < 0) {
+        // nothing changed, one row is written so the refresh runs as asked
+        y0 = y1 = 0;
+    }
+    iot_epaper_push_window(device, frame, 0, y0, frame->width - 1, y1);
+    device->row_hash_valid = true;
+}
+
+/**
+ *  @brief: this gives a service or spare frame its red plane, cleared, those
+ *          frames only get one once the device has one or a BWR refresh
+ *          needs it
+ */
+static bool iot_epaper_frame_red_plane(epaper_paint_t* frame)
+{
+    if (frame->r_image == NULL) {
+        frame->r_image = (unsigned char*) heap_caps_calloc(1, frame->width / 8 * frame->height, MALLOC_CAP_DMA);
+    }
+    return frame->r_image != NULL;
+}
+
+/**
+ *  @brief: this follows a fast refresh with a BWR refresh of the whole frame
+ *          when automatic full refreshes are on and a region used up its budget
+ */
+static void iot_epaper_check_ghosting(epaper_dev_t* device, epaper_paint_t* frame)
+{
+    if (!device->ghost_auto || !device->pin.fast_bw_mode || !iot_epaper_full_refresh_due(device)) {
+        return;
+    }
+    // the device frame gets its red plane from iot_epaper_set_mode()
+    if (frame != &device->paint && !iot_epaper_frame_red_plane(frame)) {
+        ESP_LOGE(TAG, "no memory for the red plane, full refresh skipped");
+        return;
+    }
+    ESP_LOGD(TAG, "ghosting budget used up, full refresh");
+    if (iot_epaper_set_mode(device, false) != ESP_OK) {
+        // the counters stay, the next fast refresh tries again
+        ESP_LOGE(TAG, "no BWR mode, full refresh skipped");
+        return;
+    }
+    xSemaphoreTakeRecursive(device->paint_mux, portMAX_DELAY);
+    iot_epaper_push_window(device, frame, 0, 0, device->paint.width - 1, device->paint.height - 1);
+    if (frame == &device->paint) {
+        iot_epaper_reset_dirty_area(device);
+    }
+    xSemaphoreGiveRecursive(device->paint_mux);
+    iot_epaper_wait_busy(device, E_PAPER_BUSY_REFRESH);
+    if (iot_epaper_set_mode(device, true) != ESP_OK) {
+        ESP_LOGE(TAG, "fast B/W mode not restored after the full refresh");
+    }
+}
+
+void iot_epaper_set_ghosting_budget(epaper_handle_t dev, int budget, bool auto_refresh)
 {
     epaper_dev_t* device = (epaper_dev_t*) dev;
     xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
+    device->ghost_budget = budget < 0 ? 0 : (budget > UINT16_MAX ? UINT16_MAX : budget);
+    device->ghost_auto = auto_refresh;
+    xSemaphoreGiveRecursive(device->spi_mux);
+}
 
-    if (device->pin.fast_bw_mode) {
-        iot_epaper_reset(dev);                  // hardware reset
-        iot_epaper_wait_idle(dev);
+int iot_epaper_get_fast_refresh_count(epaper_handle_t dev)
+{
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    int max = 0;
+    for (int r = 0; r < EPAPER_GHOST_ROWS; r++) {
+        for (int c = 0; c < EPAPER_GHOST_COLS; c++) {
+            max = device->ghost_count[r][c] > max ? device->ghost_count[r][c] : max;
+        }
+    }
+    return max;
+}
 
-        /* This part of code is ePaper module specific
-        * It has been copied from the instructions as it is
-        */
-        iot_epaper_send_command(dev, E_PAPER_SW_RESET); // Software reset
-        iot_epaper_wait_idle(dev);
+bool iot_epaper_full_refresh_due(epaper_handle_t dev)
+{
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    return device->ghost_budget && iot_epaper_get_fast_refresh_count(dev) >= device->ghost_budget;
+}
 
-        iot_epaper_send_command(dev, 0x74);     // Set analog block control
-        iot_epaper_send_byte(dev, 0x54);
+void iot_epaper_display_frame(epaper_handle_t dev)
+{
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+   
+    xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
 
-        iot_epaper_send_command(dev, 0x7E);     // Set digital block control
-        iot_epaper_send_byte(dev, 0x3B);
-        
+    xSemaphoreTakeRecursive(device->paint_mux, portMAX_DELAY);
+    uint32_t trans_count = iot_epaper_get_spi_transactions(device);
+    iot_epaper_push_frame(device, &device->paint);
+    ESP_LOGD(TAG, "frame sent in %u SPI transactions", iot_epaper_get_spi_transactions(device) - trans_count);
+    iot_epaper_reset_dirty_area(dev);
+    xSemaphoreGiveRecursive(device->paint_mux);
 
-        iot_epaper_send_command(dev, 0x11);     // RAM data entry mode
-        iot_epaper_send_byte(dev, 0x03);        // Address counter is updated in Y direction, Y increment, X increment
+    // the frame buffer may be drawn into again while the panel refreshes
+	iot_epaper_wait_busy(device, E_PAPER_BUSY_REFRESH);
+    iot_epaper_check_ghosting(device, &device->paint);
 
+    xSemaphoreGiveRecursive(device->spi_mux);
+}
 
-        iot_epaper_send_command(dev, 0x3C);     // Set border waveform for VBD 
-        iot_epaper_send_byte(dev, 0x01);
+/**
+ *  @brief: driver task of iot_epaper_display_frame_async. It holds the SPI
+ *          until the panel is idle again, so synchronous calls wait for the
+ *          frame in flight, and the frame buffer until the planes are sent.
+ */
+static void iot_epaper_async_task(void* arg)
+{
+    epaper_dev_t* device = (epaper_dev_t*) arg;
+    epaper_async_job_t job;
+
+    while (1) {
+        xQueueReceive(device->async_queue, &job, portMAX_DELAY);
+        xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
+        if (job.frame) {
+            // the planes are ours until the refresh is over, drawing goes on in the other pair
+            iot_epaper_push_frame(device, job.frame);
+        } else {
+            job.frame = &device->paint;
+            xSemaphoreTakeRecursive(device->paint_mux, portMAX_DELAY);
+            xSemaphoreGive(device->async_started);
+            iot_epaper_push_frame(device, job.frame);
+            iot_epaper_reset_dirty_area(device);
+            xSemaphoreGiveRecursive(device->paint_mux);
+        }
 
+        iot_epaper_wait_busy(device, E_PAPER_BUSY_REFRESH);
+        iot_epaper_check_ghosting(device, job.frame);
+        xSemaphoreGiveRecursive(device->spi_mux);
 
-        iot_epaper_send_command(dev, 0x2C);     // Set VCOM value
-        iot_epaper_send_byte(dev, 0x26);
+        if (job.done_cb) {
+            job.done_cb((epaper_handle_t) device, job.arg);
+        }
+        xSemaphoreGive(device->async_done);
+    }
+}
 
-        iot_epaper_send_command(dev, 0x03);     // Gate voltage setting (17h = 20 Volt, ranges from 10v to 21v)
-        iot_epaper_send_byte(dev, 0x17);
+static esp_err_t iot_epaper_start_async_task(epaper_dev_t* device)
+{
+    if (device->async_task == NULL &&
+            xTaskCreate(iot_epaper_async_task, "epaper_async", EPAPER_ASYNC_TASK_STACK, device,
+                    uxTaskPriorityGet(NULL), &device->async_task) != pdPASS) {
+        device->async_task = NULL;
+        ESP_LOGE(TAG, "async task create failed");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
 
-        iot_epaper_send_command(dev, 0x04);     // Source voltage setting (15volt, 0 volt and -15 volt)
-        iot_epaper_send_byte(dev, 0x41);
-        iot_epaper_send_byte(dev, 0x00);
-        iot_epaper_send_byte(dev, 0x32);
+esp_err_t iot_epaper_display_frame_async(epaper_handle_t dev, epaper_frame_done_cb_t done_cb, void* arg)
+{
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    epaper_async_job_t job = {
+        .done_cb = done_cb,
+        .arg = arg,
+        .frame = NULL,
+    };
+
+    // one frame in flight at a time
+    xSemaphoreTake(device->async_done, portMAX_DELAY);
+    if (iot_epaper_start_async_task(device) != ESP_OK) {
+        xSemaphoreGive(device->async_done);
+        return ESP_ERR_NO_MEM;
+    }
+    xQueueSend(device->async_queue, &job, portMAX_DELAY);
+    // the frame sent is the one drawn so far, later drawing waits for the planes to go out
+    xSemaphoreTake(device->async_started, portMAX_DELAY);
+    return ESP_OK;
+}
 
-        iot_epaper_set_lut(dev);
+esp_err_t iot_epaper_wait_frame_done(epaper_handle_t dev, TickType_t ticks_to_wait)
+{
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    if (xSemaphoreTake(device->async_done, ticks_to_wait) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+    xSemaphoreGive(device->async_done);
+    return ESP_OK;
+}
+
+esp_err_t iot_epaper_set_double_buffer(epaper_handle_t dev, bool enable)
+{
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    int size = device->paint.width / 8 * device->paint.height;
+
+    // the spare planes may be in flight
+    iot_epaper_wait_frame_done(dev, portMAX_DELAY);
+    if (!enable) {
+        iot_epaper_free_plane(device, device->spare.bw_image);
+        iot_epaper_free_plane(device, device->spare.r_image);
+        device->spare.bw_image = NULL;
+        device->spare.r_image = NULL;
+        return ESP_OK;
+    }
+    if (device->spare.bw_image) {
+        return ESP_OK;
+    }
+    device->spare.bw_image = (unsigned char*) heap_caps_malloc(size, MALLOC_CAP_DMA);
+    if (device->paint.r_image) {
+        device->spare.r_image = (unsigned char*) heap_caps_malloc(size, MALLOC_CAP_DMA);
+    }
+    if (!device->spare.bw_image || (device->paint.r_image && !device->spare.r_image)) {
+        free(device->spare.bw_image);
+        free(device->spare.r_image);
+        device->spare.bw_image = NULL;
+        device->spare.r_image = NULL;
+        ESP_LOGE(TAG, "no memory for the second frame buffer");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t iot_epaper_swap_frame(epaper_handle_t dev, epaper_frame_done_cb_t done_cb, void* arg, TickType_t ticks_to_wait)
+{
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    int size = device->paint.width / 8 * device->paint.height;
+    unsigned char* bw_image;
+    unsigned char* r_image;
+    epaper_async_job_t job = {
+        .done_cb = done_cb,
+        .arg = arg,
+        .frame = &device->spare,
+    };
+
+    if (device->spare.bw_image == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    // the spare planes belong to the driver task until the previous refresh is over
+    if (xSemaphoreTake(device->async_done, ticks_to_wait) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+    if (iot_epaper_start_async_task(device) != ESP_OK) {
+        xSemaphoreGive(device->async_done);
+        return ESP_ERR_NO_MEM;
+    }
+
+    xSemaphoreTakeRecursive(device->paint_mux, portMAX_DELAY);
+    bw_image = device->spare.bw_image;
+    r_image = device->spare.r_image;
+    device->spare = device->paint;
+    device->paint.bw_image = bw_image;
+    device->paint.r_image = r_image;
+    // drawing goes on from the frame sent, as with a single frame buffer
+    memcpy(device->paint.bw_image, device->spare.bw_image, size);
+    if (device->paint.r_image) {
+        memcpy(device->paint.r_image, device->spare.r_image, size);
+    }
+    iot_epaper_reset_dirty_area(device);
+    xSemaphoreGiveRecursive(device->paint_mux);
+
+    xQueueSend(device->async_queue, &job, portMAX_DELAY);
+    return ESP_OK;
+}
+
+/**
+ *  @brief: this turns the area (x0,y0)-(x1,y1) in the coordinates of the current
+ *          rotation into a window of the controller RAM, clipped to the panel
+ *          and widened to whole bytes along X
+ *  @return false if the area is off the panel
+ */
+static bool iot_epaper_get_window(epaper_dev_t* device, int x0, int y0, int x1, int y1, epaper_area_t* window)
+{
+    iot_epaper_rotate_point(device, &x0, &y0);
+    iot_epaper_rotate_point(device, &x1, &y1);
+    window->x0 = x1 > x0 ? x0 : x1;
+    window->x1 = x1 > x0 ? x1 : x0;
+    window->y0 = y1 > y0 ? y0 : y1;
+    window->y1 = y1 > y0 ? y1 : y0;
+    window->x0 = window->x0 < 0 ? 0 : window->x0;
+    window->y0 = window->y0 < 0 ? 0 : window->y0;
+    window->x1 = window->x1 >= device->paint.width ? device->paint.width - 1 : window->x1;
+    window->y1 = window->y1 >= device->paint.height ? device->paint.height - 1 : window->y1;
+    if (window->x0 > window->x1 || window->y0 > window->y1) {
+        return false;
+    }
+    /* the controller RAM is addressed in bytes along X */
+    window->x0 &= ~7;
+    window->x1 |= 7;
+    return true;
+}
+
+void iot_epaper_display_region(epaper_handle_t dev, int x0, int y0, int x1, int y1)
+{
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    epaper_area_t* dirty = &device->paint.dirty;
+    epaper_area_t window;
+
+    xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
+    xSemaphoreTakeRecursive(device->paint_mux, portMAX_DELAY);
+
+    if (!iot_epaper_get_window(device, x0, y0, x1, y1, &window)) {
+        xSemaphoreGiveRecursive(device->paint_mux);
+        xSemaphoreGiveRecursive(device->spi_mux);
+        return;
+    }
+
+    iot_epaper_push_window(dev, &device->paint, window.x0, window.y0, window.x1, window.y1);
+    if (dirty->x0 >= window.x0 && dirty->y0 >= window.y0 && dirty->x1 <= window.x1 && dirty->y1 <= window.y1) {
+        iot_epaper_reset_dirty_area(dev);
+    }
+    xSemaphoreGiveRecursive(device->paint_mux);
+
+	iot_epaper_wait_busy(device, E_PAPER_BUSY_REFRESH);
+    iot_epaper_check_ghosting(device, &device->paint);
+
+    xSemaphoreGiveRecursive(device->spi_mux);
+}
+
+/**
+ *  @brief: this copies the window of both planes of a frame, absolute coordinates.
+ *          The destination has a red plane if the source has one, it is cleared
+ *          if the source has none.
+ */
+static void iot_epaper_copy_window(epaper_paint_t* dst, const epaper_paint_t* src, const epaper_area_t* window)
+{
+    int stride = src->width / 8;
+    int row_bytes = (window->x1 - window->x0 + 1) / 8;
+    int offset = window->y0 * stride + window->x0 / 8;
+
+    if (row_bytes == stride) {
+        row_bytes *= window->y1 - window->y0 + 1;
+        memcpy(&dst->bw_image[offset], &src->bw_image[offset], row_bytes);
+        if (src->r_image) {
+            memcpy(&dst->r_image[offset], &src->r_image[offset], row_bytes);
+        } else if (dst->r_image) {
+            memset(&dst->r_image[offset], 0x00, row_bytes);
+        }
+        return;
+    }
+    for (int y = window->y0; y <= window->y1; y++, offset += stride) {
+        memcpy(&dst->bw_image[offset], &src->bw_image[offset], row_bytes);
+        if (src->r_image) {
+            memcpy(&dst->r_image[offset], &src->r_image[offset], row_bytes);
+        } else if (dst->r_image) {
+            memset(&dst->r_image[offset], 0x00, row_bytes);
+        }
+    }
+}
+
+static void iot_epaper_area_union(epaper_area_t* area, const epaper_area_t* other)
+{
+    area->x0 = other->x0 < area->x0 ? other->x0 : area->x0;
+    area->y0 = other->y0 < area->y0 ? other->y0 : area->y0;
+    area->x1 = other->x1 > area->x1 ? other->x1 : area->x1;
+    area->y1 = other->y1 > area->y1 ? other->y1 : area->y1;
+}
+
+/**
+ *  @brief: display service task. It takes the newest submission, copies its
+ *          window out of service_frame so drawing and submitting can go on,
+ *          and pushes it in the requested mode.
+ */
+static void iot_epaper_service_task(void* arg)
+{
+    epaper_dev_t* device = (epaper_dev_t*) arg;
+    epaper_service_job_t job;
+    bool full;
+
+    while (1) {
+        xQueueReceive(device->service_queue, &job, portMAX_DELAY);
+        xSemaphoreTake(device->service_mux, portMAX_DELAY);
+        if (!device->service_pending) {
+            // merged into a frame that went out already
+            xSemaphoreGive(device->service_mux);
+            continue;
+        }
+        job = device->service_job;
+        if (device->service_frame.r_image && !iot_epaper_frame_red_plane(&device->service_work)) {
+            device->service_pending = false;
+            device->service_stats.failed++;
+            xSemaphoreGive(device->service_mux);
+            ESP_LOGE(TAG, "display service frame dropped, no memory for the red plane");
+            continue;
+        }
+        iot_epaper_copy_window(&device->service_work, &device->service_frame, &job.window);
+        device->service_work.dirty = device->service_frame.dirty;
+        device->service_frame.dirty.x0 = INT_MAX;
+        device->service_frame.dirty.y0 = INT_MAX;
+        device->service_frame.dirty.x1 = -1;
+        device->service_frame.dirty.y1 = -1;
+        device->service_pending = false;
+        xSemaphoreGive(device->service_mux);
+
+        full = job.window.x0 == 0 && job.window.y0 == 0 &&
+               job.window.x1 == device->paint.width - 1 && job.window.y1 == device->paint.height - 1;
+        xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
+        if (iot_epaper_set_mode(device, job.fast_bw_mode) != ESP_OK) {
+            xSemaphoreGiveRecursive(device->spi_mux);
+            ESP_LOGE(TAG, "display service frame dropped, no BWR mode");
+            xSemaphoreTake(device->service_mux, portMAX_DELAY);
+            device->service_stats.failed++;
+            xSemaphoreGive(device->service_mux);
+            continue;
+        }
+        iot_epaper_push_window(device, &device->service_work, job.window.x0, job.window.y0, job.window.x1, job.window.y1);
+        iot_epaper_wait_busy(device, E_PAPER_BUSY_REFRESH);
+        if (full) {
+            iot_epaper_check_ghosting(device, &device->service_work);
+        }
+        xSemaphoreGiveRecursive(device->spi_mux);
+        xSemaphoreTake(device->service_mux, portMAX_DELAY);
+        device->service_stats.pushed++;
+        if (job.fast_bw_mode && device->red_on_demand) {
+            // back in fast mode with the device, a BWR submission gets them again
+            free(device->service_work.r_image);
+            device->service_work.r_image = NULL;
+            if (!device->service_pending || device->service_job.fast_bw_mode) {
+                free(device->service_frame.r_image);
+                device->service_frame.r_image = NULL;
+            }
+        }
+        xSemaphoreGive(device->service_mux);
+    }
+}
+
+esp_err_t iot_epaper_service_start(epaper_handle_t dev)
+{
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    int size = device->paint.width / 8 * device->paint.height;
+    epaper_paint_t* frames[2] = { &device->service_frame, &device->service_work };
+
+    if (device->service_task) {
+        return ESP_OK;
+    }
+    // the red planes come with the first BWR frame on a B/W only device
+    xSemaphoreTakeRecursive(device->paint_mux, portMAX_DELAY);
+    for (int i = 0; i < 2; i++) {
+        *frames[i] = device->paint;
+        frames[i]->bw_image = (unsigned char*) heap_caps_malloc(size, MALLOC_CAP_DMA);
+        frames[i]->r_image = NULL;
+        if (device->paint.r_image) {
+            frames[i]->r_image = (unsigned char*) heap_caps_malloc(size, MALLOC_CAP_DMA);
+        }
+    }
+    device->service_queue = xQueueCreate(1, sizeof(epaper_service_job_t));
+    device->service_mux = xSemaphoreCreateMutex();
+    if (!device->service_frame.bw_image || !device->service_work.bw_image ||
+            (device->paint.r_image && (!device->service_frame.r_image || !device->service_work.r_image)) ||
+            !device->service_queue || !device->service_mux) {
+        xSemaphoreGiveRecursive(device->paint_mux);
+        goto fail;
+    }
+    // what is on screen so far
+    memcpy(device->service_frame.bw_image, device->paint.bw_image, size);
+    if (device->paint.r_image) {
+        memcpy(device->service_frame.r_image, device->paint.r_image, size);
+    }
+    xSemaphoreGiveRecursive(device->paint_mux);
+    device->service_frame.dirty.x0 = INT_MAX;
+    device->service_frame.dirty.y0 = INT_MAX;
+    device->service_frame.dirty.x1 = -1;
+    device->service_frame.dirty.y1 = -1;
+    if (xTaskCreate(iot_epaper_service_task, "epaper_service", EPAPER_SERVICE_TASK_STACK, device,
+            uxTaskPriorityGet(NULL), &device->service_task) != pdPASS) {
+        device->service_task = NULL;
+        goto fail;
+    }
+    return ESP_OK;
 
-        iot_epaper_send_command(dev, 0x3A);     // write number of overscan lines
-        iot_epaper_send_byte(dev, 26);          // 26 dummy lines per gate
-        iot_epaper_send_command(dev, 0x3B);     // write time to write every line
-        iot_epaper_send_byte(dev, 0x08);        // 62us per line
+fail:
+    ESP_LOGE(TAG, "display service start failed");
+    for (int i = 0; i < 2; i++) {
+        free(frames[i]->bw_image);
+        free(frames[i]->r_image);
+        frames[i]->bw_image = NULL;
+        frames[i]->r_image = NULL;
+    }
+    if (device->service_queue) {
+        vQueueDelete(device->service_queue);
+        device->service_queue = NULL;
+    }
+    if (device->service_mux) {
+        vSemaphoreDelete(device->service_mux);
+        device->service_mux = NULL;
+    }
+    return ESP_ERR_NO_MEM;
+}
 
-        // configure length of update
-        iot_epaper_send_command(dev, E_PAPER_DRIVER_OUTPUT_CONTROL);
-        iot_epaper_send_byte(dev, 0x27);        // y_len & 0xff
-        iot_epaper_send_byte(dev, 0x01);        // y_len >> 8
-        iot_epaper_send_byte(dev, 0x00);
+/**
+ *  @brief: this hands the window of the frame buffer to the display service.
+ *          A submission not pushed yet is merged with the new one.
+ */
+static esp_err_t iot_epaper_submit_window(epaper_dev_t* device, const epaper_area_t* window, bool fast_bw_mode)
+{
+    epaper_area_t* dirty = &device->paint.dirty;
+    epaper_service_job_t* job = &device->service_job;
 
-        iot_epaper_send_command(dev, 0x0f);     // configure starting-line of update
-        iot_epaper_send_byte(dev, 0x00);        // y_start & 0xff
-        iot_epaper_send_byte(dev, 0x00); 
+    if (device->service_task == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(device->service_mux, portMAX_DELAY);
+    xSemaphoreTakeRecursive(device->paint_mux, portMAX_DELAY);
+    if ((device->paint.r_image || !fast_bw_mode) && !iot_epaper_frame_red_plane(&device->service_frame)) {
+        xSemaphoreGiveRecursive(device->paint_mux);
+        xSemaphoreGive(device->service_mux);
+        ESP_LOGE(TAG, "no memory for the display service red plane");
+        return ESP_ERR_NO_MEM;
+    }
+    iot_epaper_copy_window(&device->service_frame, &device->paint, window);
+    iot_epaper_area_union(&device->service_frame.dirty, dirty);
+    if (dirty->x0 >= window->x0 && dirty->y0 >= window->y0 && dirty->x1 <= window->x1 && dirty->y1 <= window->y1) {
+        iot_epaper_reset_dirty_area(device);
+    }
+    xSemaphoreGiveRecursive(device->paint_mux);
 
-        iot_set_ram_area(dev, 0, 0, EPD_WIDTH-1, EPD_HEIGHT-1);
+    if (device->service_pending) {
+        // a BWR refresh covers what the fast one would do
+        iot_epaper_area_union(&job->window, window);
+        job->fast_bw_mode = job->fast_bw_mode && fast_bw_mode;
+        device->service_stats.dropped++;
     } else {
+        job->window = *window;
+        job->fast_bw_mode = fast_bw_mode;
+        device->service_pending = true;
+    }
+    device->service_stats.submitted++;
+    xQueueOverwrite(device->service_queue, job);
+    xSemaphoreGive(device->service_mux);
+    return ESP_OK;
+}
 
-        iot_epaper_reset(dev);                  // hardware reset
-        iot_epaper_wait_idle(dev);
+esp_err_t iot_epaper_submit_frame(epaper_handle_t dev, bool fast_bw_mode)
+{
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    epaper_area_t window = { 0, 0, device->paint.width - 1, device->paint.height - 1 };
+    return iot_epaper_submit_window(device, &window, fast_bw_mode);
+}
 
-        /* This part of code is ePaper module specific
-        * It has been copied from the instructions as it is
-        */
-        iot_epaper_send_command(dev, E_PAPER_SW_RESET); // Software reset
-        iot_epaper_wait_idle(dev);
+esp_err_t iot_epaper_submit_region(epaper_handle_t dev, int x0, int y0, int x1, int y1, bool fast_bw_mode)
+{
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    epaper_area_t window;
+    if (!iot_epaper_get_window(device, x0, y0, x1, y1, &window)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return iot_epaper_submit_window(device, &window, fast_bw_mode);
+}
 
-        iot_epaper_send_command(dev, 0x74);     // Set analog block control
-        iot_epaper_send_byte(dev, 0x54);
+void iot_epaper_get_service_stats(epaper_handle_t dev, epaper_service_stats_t* stats)
+{
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    if (device->service_task == NULL) {
+        memset(stats, 0, sizeof(epaper_service_stats_t));
+        return;
+    }
+    xSemaphoreTake(device->service_mux, portMAX_DELAY);
+    *stats = device->service_stats;
+    stats->depth = device->service_pending ? 1 : 0;
+    xSemaphoreGive(device->service_mux);
+}
 
-        iot_epaper_send_command(dev, 0x7E);     // Set digital block control
-        iot_epaper_send_byte(dev, 0x3B);
-        
+esp_err_t iot_epaper_trace_start(epaper_handle_t dev)
+{
+#ifdef CONFIG_EPAPER_SPI_TRACE
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    epaper_trace_t* trace = &device->trace;
+    xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
+    if (trace->buf == NULL) {
+        trace->buf = (uint8_t*) malloc(CONFIG_EPAPER_SPI_TRACE_BUFFER_SIZE);
+        if (trace->buf == NULL) {
+            xSemaphoreGiveRecursive(device->spi_mux);
+            ESP_LOGE(TAG, "no memory for a %d byte trace", CONFIG_EPAPER_SPI_TRACE_BUFFER_SIZE);
+            return ESP_ERR_NO_MEM;
+        }
+        trace->size = CONFIG_EPAPER_SPI_TRACE_BUFFER_SIZE;
+    }
+    trace->head = trace->tail = trace->used = 0;
+    trace->records = trace->dropped = 0;
+    trace->on = true;
+    xSemaphoreGiveRecursive(device->spi_mux);
+    return ESP_OK;
+#else
+    (void) dev;
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t iot_epaper_trace_stop(epaper_handle_t dev)
+{
+#ifdef CONFIG_EPAPER_SPI_TRACE
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
+    device->trace.on = false;
+    xSemaphoreGiveRecursive(device->spi_mux);
+    return ESP_OK;
+#else
+    (void) dev;
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
 
-        iot_epaper_send_command(dev, 0x11);     // RAM data entry mode
-        iot_epaper_send_byte(dev, 0x03);        // Address counter is updated in Y direction, Y increment, X increment
+#ifdef CONFIG_EPAPER_SPI_TRACE
+/**
+ *  @brief: this writes part of a trace dump, as is or as EPTRACE: lines of hex
+ */
+static void iot_epaper_trace_write(FILE* out, const uint8_t* data, size_t n, bool hex)
+{
+    if (!hex) {
+        fwrite(data, 1, n, out);
+        return;
+    }
+    for (size_t i = 0; i < n; i += 32) {
+        fputs("EPTRACE:", out);
+        for (size_t j = i; j < n && j < i + 32; j++) {
+            fprintf(out, "%02x", data[j]);
+        }
+        fputc('\n', out);
+    }
+}
+#endif
 
+esp_err_t iot_epaper_trace_dump(epaper_handle_t dev, FILE* out, bool hex)
+{
+#ifdef CONFIG_EPAPER_SPI_TRACE
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    epaper_trace_t* trace = &device->trace;
+    epaper_trace_header_t header = {
+        .magic = E_PAPER_TRACE_MAGIC,
+        .version = E_PAPER_TRACE_VERSION,
+        .record_size = sizeof(epaper_trace_record_t),
+    };
+    size_t first;
 
-        iot_epaper_send_command(dev, 0x3C);     // Set border waveform for VBD 
-        iot_epaper_send_byte(dev, 0x01);
-        
-        iot_epaper_send_command(dev, 0x18);     //Temperature sensor selection
-        iot_epaper_send_byte(dev, 0x80);
-        
-        
-        iot_epaper_send_command(dev, 0x22);     //Enable the stage for master activation
-        iot_epaper_send_byte(dev, 0xB1);
+    xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
+    header.records = trace->records;
+    header.dropped = trace->dropped;
+    if (hex) {
+        fprintf(out, "EPTRACE BEGIN\n");
+    }
+    iot_epaper_trace_write(out, (const uint8_t*) &header, sizeof(header), hex);
+    // the records are one byte stream from the tail, wrapped at most once
+    first = trace->size - trace->tail;
+    first = first < trace->used ? first : trace->used;
+    if (trace->used) {
+        iot_epaper_trace_write(out, trace->buf + trace->tail, first, hex);
+        iot_epaper_trace_write(out, trace->buf, trace->used - first, hex);
+    }
+    if (hex) {
+        fprintf(out, "EPTRACE END %u records, %u dropped\n", header.records, header.dropped);
+    }
+    xSemaphoreGiveRecursive(device->spi_mux);
+    fflush(out);
+    return ferror(out) ? ESP_FAIL : ESP_OK;
+#else
+    (void) dev;
+    (void) out;
+    (void) hex;
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
 
-        iot_set_ram_area(dev, 0, 0, EPD_WIDTH-1, EPD_HEIGHT-1);
-        
-        iot_epaper_send_command(dev, 0x20);		//Master activation
+void iot_epaper_sleep(epaper_handle_t dev)
+{
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
+    int count = 0;
+    iot_epaper_queue_command(device, &count, E_PAPER_DEEP_SLEEP_MODE, NULL, 0);
+    iot_epaper_flush_trans(device, &count);
+    // the RAM content is lost in deep sleep
+    device->row_hash_valid = false;
+    iot_epaper_wait_busy(device, E_PAPER_BUSY_SLEEP);
+    xSemaphoreGiveRecursive(device->spi_mux);
+}
 
+/**
+ *  @brief: this runs an init sequence, see epaper_init_common. Steps are
+ *          queued back to back and only waited for before a busy wait.
+ */
+static void iot_epaper_run_sequence(epaper_dev_t* device, const uint8_t* seq, size_t size)
+{
+    int count = 0;
+    size_t i = 0;
+
+    while (i + 1 < size) {
+        uint8_t command = seq[i];
+        uint8_t flags = seq[i + 1];
+        int length = flags & EPAPER_SEQ_COUNT_MASK;
+
+        if (flags & EPAPER_SEQ_LUT) {
+            iot_epaper_queue_lut(device, &count);
+        } else {
+            iot_epaper_queue_command(device, &count, command, &seq[i + 2], length);
+        }
+        // a software reset clears the LUT register, a master activation of the init loads the OTP one
+        if (command == E_PAPER_SW_RESET || command == E_PAPER_MASTER_ACTIVATION) {
+            device->lut_loaded = EPAPER_LUT_NONE;
+        }
+        if (command == E_PAPER_SW_RESET) {
+            device->row_hash_valid = false;
+        }
+        i += 2 + length;
+        if (flags & EPAPER_SEQ_WAIT_BUSY) {
+            iot_epaper_flush_trans(device, &count);
+            iot_epaper_wait_busy(device, command == E_PAPER_SW_RESET ? E_PAPER_BUSY_SW_RESET : E_PAPER_BUSY_OTHER);
+        }
+    }
+    iot_epaper_flush_trans(device, &count);
+}
+
+static void iot_epaper_epd_init(epaper_handle_t dev)
+{
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
+
+    iot_epaper_reset(dev);                  // hardware reset
+    iot_epaper_run_sequence(device, epaper_init_common, sizeof(epaper_init_common));
+    if (device->pin.fast_bw_mode) {
+        iot_epaper_run_sequence(device, epaper_init_fast_bw, sizeof(epaper_init_fast_bw));
+    } else {
+        iot_epaper_run_sequence(device, epaper_init_bwr, sizeof(epaper_init_bwr));
     }
 
     xSemaphoreGiveRecursive(device->spi_mux);
 }
 
-static esp_err_t iot_epaper_spi_init(epaper_handle_t dev, spi_device_handle_t *e_spi, epaper_conf_t *pin)
+/**
+ *  @brief: this adds the red plane to a device created without one, for BWR
+ *          mode. Nothing drawn so far is red.
+ */
+static esp_err_t iot_epaper_add_red_plane(epaper_dev_t* device)
+{
+    int size = device->paint.width / 8 * device->paint.height;
+    unsigned char* r_image;
+    unsigned char* spare_r_image = NULL;
+
+    if (device->paint.r_image) {
+        return ESP_OK;
+    }
+    r_image = (unsigned char*) heap_caps_calloc(1, size, MALLOC_CAP_DMA);
+    // a spare frame in flight may have got its own from iot_epaper_check_ghosting()
+    if (device->spare.bw_image && device->spare.r_image == NULL) {
+        spare_r_image = (unsigned char*) heap_caps_calloc(1, size, MALLOC_CAP_DMA);
+    }
+    if (!r_image || (device->spare.bw_image && device->spare.r_image == NULL && !spare_r_image)) {
+        free(r_image);
+        free(spare_r_image);
+        ESP_LOGE(TAG, "no memory for the red plane");
+        return ESP_ERR_NO_MEM;
+    }
+    xSemaphoreTakeRecursive(device->paint_mux, portMAX_DELAY);
+    device->paint.r_image = r_image;
+    if (spare_r_image) {
+        device->spare.r_image = spare_r_image;
+    }
+    xSemaphoreGiveRecursive(device->paint_mux);
+    ESP_LOGD(TAG, "red plane allocated, %d bytes", spare_r_image ? 2 * size : size);
+    return ESP_OK;
+}
+
+/**
+ *  @brief: this frees the red planes iot_epaper_add_red_plane() and
+ *          iot_epaper_check_ghosting() gave a B/W only device, back in fast
+ *          mode. The caller holds spi_mux, no frame is in flight.
+ */
+static void iot_epaper_drop_red_plane(epaper_dev_t* device)
+{
+    if (!device->red_on_demand) {
+        return;
+    }
+    xSemaphoreTakeRecursive(device->paint_mux, portMAX_DELAY);
+    free(device->paint.r_image);
+    free(device->spare.r_image);
+    device->paint.r_image = NULL;
+    device->spare.r_image = NULL;
+    xSemaphoreGiveRecursive(device->paint_mux);
+    ESP_LOGD(TAG, "red plane freed");
+}
+
+esp_err_t iot_epaper_set_mode(epaper_handle_t dev, bool fast_bw_mode)
+{
+    epaper_dev_t* device = (epaper_dev_t*) dev;
+    int64_t t0 = esp_timer_get_time();
+
+    // waits for a frame in flight as well
+    xSemaphoreTakeRecursive(device->spi_mux, portMAX_DELAY);
+    if (device->pin.fast_bw_mode == fast_bw_mode) {
+        xSemaphoreGiveRecursive(device->spi_mux);
+        return ESP_OK;
+    }
+    if (!fast_bw_mode && iot_epaper_add_red_plane(device) != ESP_OK) {
+        xSemaphoreGiveRecursive(device->spi_mux);
+        return ESP_ERR_NO_MEM;
+    }
+    if (fast_bw_mode) {
+        // the fast mode registers and LUT override what the BWR init left
+        iot_epaper_run_sequence(device, epaper_init_fast_bw, sizeof(epaper_init_fast_bw));
+    } else {
+        // back to the OTP waveform, the software reset drops the fast mode registers
+        iot_epaper_run_sequence(device, epaper_init_common, sizeof(epaper_init_common));
+        iot_epaper_run_sequence(device, epaper_init_bwr, sizeof(epaper_init_bwr));
+    }
+    device->pin.fast_bw_mode = fast_bw_mode;
+    if (fast_bw_mode) {
+        iot_epaper_drop_red_plane(device);
+    }
+    // the fast mode only writes the B/W RAM, a frame is sent whole after a switch
+    device->row_hash_valid = false;
+    xSemaphoreGiveRecursive(device->spi_mux);
+    ESP_LOGD(TAG, "mode switched to %s in %d us", fast_bw_mode ? "fast B/W" : "BWR", (int) (esp_timer_get_time() - t0));
+    return ESP_OK;
+}
+
+static esp_err_t iot_epaper_spi_init(spi_device_handle_t *e_spi, epaper_conf_t *pin)
 {
     esp_err_t ret;
     spi_bus_config_t buscfg = {
@@ -771,7 +2712,12 @@ static esp_err_t iot_epaper_spi_init(epaper_handle_t dev, spi_device_handle_t *e
         // We are sending only in one direction (to the ePaper slave)
         .flags = (SPI_DEVICE_HALFDUPLEX | SPI_DEVICE_3WIRE),
         //Specify pre-transfer callback to handle D/C line
+#ifdef CONFIG_EPAPER_SPI_TRACE
+        .pre_cb = iot_epaper_pre_transfer_trace,
+        .post_cb = iot_epaper_post_transfer_trace,
+#else
         .pre_cb = iot_epaper_pre_transfer_callback,
+#endif
     };
     ret = spi_bus_initialize(pin->spi_host, &buscfg, 2);
     assert(ret == ESP_OK);
@@ -780,27 +2726,124 @@ static esp_err_t iot_epaper_spi_init(epaper_handle_t dev, spi_device_handle_t *e
     return ret;
 }
 
-epaper_handle_t iot_epaper_create(spi_device_handle_t bus, epaper_conf_t *epconf)
+/**
+ *  @brief: the device block is the device followed by its planes, word aligned
+ */
+static size_t iot_epaper_plane_size(const epaper_conf_t* epconf)
 {
-    epaper_dev_t* dev = (epaper_dev_t*) calloc(1, sizeof(epaper_dev_t));
+    return epconf->width * epconf->height / 8;
+}
+
+static size_t iot_epaper_planes(const epaper_conf_t* epconf)
+{
+    // the fast mode sends the B/W plane only
+    return epconf->fast_bw_mode && epconf->bw_only ? 1 : 2;
+}
+
+size_t iot_epaper_get_storage_size(const epaper_conf_t* epconf)
+{
+    return ((sizeof(epaper_dev_t) + 3) & ~3) + iot_epaper_planes(epconf) * ((iot_epaper_plane_size(epconf) + 3) & ~3);
+}
+
+/**
+ *  @brief: this sets up a device in its block, and the panel
+ */
+static epaper_handle_t iot_epaper_init_device(spi_device_handle_t bus, epaper_conf_t *epconf, uint8_t* arena, bool static_storage)
+{
+    epaper_dev_t* dev = (epaper_dev_t*) arena;
+    size_t plane_size = (iot_epaper_plane_size(epconf) + 3) & ~3;
+    uint8_t* bw_frame_buf = arena + ((sizeof(epaper_dev_t) + 3) & ~3);
+    uint8_t* r_frame_buf = iot_epaper_planes(epconf) == 2 ? bw_frame_buf + plane_size : NULL;
+    portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+    memset(dev, 0, sizeof(epaper_dev_t));
+    dev->stats_lock = stats_lock;   // a zeroed portMUX is not an unlocked one
+    dev->arena_size = iot_epaper_get_storage_size(epconf);
+    dev->static_storage = static_storage;
+    dev->red_on_demand = r_frame_buf == NULL;
     dev->spi_mux = xSemaphoreCreateRecursiveMutex();
-    
-	uint8_t* bw_frame_buf = (unsigned char*) heap_caps_malloc(
-            (epconf->width * epconf->height / 8), MALLOC_CAP_8BIT);
-	
-	uint8_t* r_frame_buf = (unsigned char*) heap_caps_malloc(
-            (epconf->width * epconf->height / 8), MALLOC_CAP_8BIT);
-	
+    dev->paint_mux = xSemaphoreCreateRecursiveMutex();
+    dev->async_queue = xQueueCreate(1, sizeof(epaper_async_job_t));
+    dev->async_done = xSemaphoreCreateBinary();
+    dev->async_started = xSemaphoreCreateBinary();
+    if (!dev->spi_mux || !dev->paint_mux || !dev->async_queue || !dev->async_done || !dev->async_started) {
+        ESP_LOGE(TAG, "no memory for the device semaphores");
+        if (dev->spi_mux) {
+            vSemaphoreDelete(dev->spi_mux);
+        }
+        if (dev->paint_mux) {
+            vSemaphoreDelete(dev->paint_mux);
+        }
+        if (dev->async_queue) {
+            vQueueDelete(dev->async_queue);
+        }
+        if (dev->async_done) {
+            vSemaphoreDelete(dev->async_done);
+        }
+        if (dev->async_started) {
+            vSemaphoreDelete(dev->async_started);
+        }
+        return NULL;
+    }
+    xSemaphoreGive(dev->async_done);
+    if (r_frame_buf == NULL) {
+        ESP_LOGI(TAG, "no red plane, %d bytes of heap saved", (int) iot_epaper_plane_size(epconf));
+    }
+
     iot_epaper_gpio_init(epconf);
     ESP_LOGD(TAG, "gpio init ok");
     if (bus) {
         dev->bus = bus;
     } else {
-        iot_epaper_spi_init(dev, &dev->bus, epconf);
+        iot_epaper_spi_init(&dev->bus, epconf);
         ESP_LOGD(TAG, "spi init ok");
     }
     dev->pin = *epconf;
+    dev->dc_cmd.dc_io = epconf->dc_pin;
+    dev->dc_cmd.dc_level = epconf->dc_lev_cmd;
+    dev->dc_data.dc_io = epconf->dc_pin;
+    dev->dc_data.dc_level = epconf->dc_lev_data;
+    iot_epaper_busy_isr_init(dev);
+    dev->luts[E_PAPER_LUT_FULL].data = lut_full_update;
+    dev->luts[E_PAPER_LUT_FULL].size = sizeof(lut_full_update);
+    dev->luts[E_PAPER_LUT_PARTIAL].data = lut_partial_update;
+    dev->luts[E_PAPER_LUT_PARTIAL].size = sizeof(lut_partial_update);
+    dev->lut_count = E_PAPER_LUT_CUSTOM;
+    dev->lut_selected = E_PAPER_LUT_FULL;
+    dev->lut_loaded = EPAPER_LUT_NONE;
+    dev->lut_refresh = EPAPER_LUT_NONE;
     iot_epaper_epd_init(dev);
     iot_epaper_paint_init(dev, bw_frame_buf, r_frame_buf, epconf->width, epconf->height);
     return (epaper_handle_t) dev;
+}
+
+epaper_handle_t iot_epaper_create(spi_device_handle_t bus, epaper_conf_t *epconf)
+{
+    // one block the SPI DMA can read the planes from without copying them
+    uint8_t* arena = (uint8_t*) heap_caps_malloc(iot_epaper_get_storage_size(epconf), MALLOC_CAP_DMA);
+    epaper_handle_t dev;
+
+    if (arena == NULL) {
+        ESP_LOGE(TAG, "no memory for the device, %d bytes", (int) iot_epaper_get_storage_size(epconf));
+        return NULL;
+    }
+    dev = iot_epaper_init_device(bus, epconf, arena, false);
+    if (dev == NULL) {
+        free(arena);
+    }
+    return dev;
+}
+
+epaper_handle_t iot_epaper_create_static(spi_device_handle_t bus, epaper_conf_t *epconf, void* storage, size_t size)
+{
+    if (storage == NULL || ((uintptr_t) storage & 3) || size < iot_epaper_get_storage_size(epconf)) {
+        ESP_LOGE(TAG, "storage must be word aligned and at least %d bytes", (int) iot_epaper_get_storage_size(epconf));
+        return NULL;
+    }
+    // the planes are sent from place, the SPI DMA cannot read e.g. PSRAM or flash
+    if (!esp_ptr_dma_capable(storage)) {
+        ESP_LOGE(TAG, "storage must be DMA capable");
+        return NULL;
+    }
+    return iot_epaper_init_device(bus, epconf, (uint8_t*) storage, true);
 }
\ No newline at end of file
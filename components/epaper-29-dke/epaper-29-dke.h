@@ -21,6 +21,7 @@
 extern "C"
 {
 #endif
+#include <stdio.h>
 #include "driver/spi_master.h"
 
 // Display orientation
@@ -38,6 +39,106 @@ typedef struct
     const uint8_t *font_table;
 } epaper_font_t;
 
+/* Rectangular area, both corners included */
+typedef struct
+{
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+} epaper_area_t;
+
+/* Glyph cache counters */
+typedef struct
+{
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    size_t budget;      /* bytes the cache may use, 0 when disabled */
+    size_t used;        /* bytes in use */
+    size_t glyphs;      /* glyphs cached */
+} epaper_glyph_cache_stats_t;
+
+/* Operations the panel is busy for */
+typedef enum {
+    E_PAPER_BUSY_RESET,     /* hardware reset */
+    E_PAPER_BUSY_SW_RESET,  /* software reset */
+    E_PAPER_BUSY_REFRESH,   /* display update */
+    E_PAPER_BUSY_SLEEP,     /* entering deep sleep */
+    E_PAPER_BUSY_OTHER,     /* iot_epaper_wait_idle() called by the application */
+    E_PAPER_BUSY_MAX,
+} epaper_busy_op_t;
+
+/* Busy pin durations of one operation */
+typedef struct
+{
+    uint32_t count;
+    uint32_t timeouts;
+    uint32_t last_us;
+    uint32_t max_us;
+    uint64_t total_us;
+    uint32_t last_wake_us;  /* busy pin edge to the waiting task running, when woken by the interrupt */
+    uint32_t max_wake_us;
+} epaper_busy_stats_t;
+
+/* Performance counters of a device, see iot_epaper_get_stats() */
+typedef struct
+{
+    uint64_t render_us;         /* time spent in drawing calls, iot_epaper_clean_paint() and iot_epaper_draw_*() */
+    uint32_t render_calls;      /* drawing calls, those made by other drawing calls not counted */
+    uint32_t spi_transactions;  /* SPI transactions sent to the panel */
+    uint64_t spi_bytes;         /* bytes they sent */
+    uint64_t wait_idle_us;      /* time waiting for the busy pin, iot_epaper_wait_idle() and the driver's own waits */
+    uint32_t full_refreshes;    /* BWR refreshes */
+    uint32_t fast_refreshes;    /* fast B/W refreshes, whole frames and regions */
+    uint32_t last_refresh_us;   /* last refresh, from its first byte sent until the panel was idle again */
+} epaper_stats_t;
+
+/* Waveforms of the LUT registry, iot_epaper_register_lut() adds ids from E_PAPER_LUT_CUSTOM on */
+enum {
+    E_PAPER_LUT_FULL,       /* lut_full_update, loaded by default */
+    E_PAPER_LUT_PARTIAL,    /* lut_partial_update */
+    E_PAPER_LUT_CUSTOM,
+};
+
+/* Display service counters */
+typedef struct
+{
+    uint32_t submitted;     /* frames submitted */
+    uint32_t pushed;        /* refreshes done */
+    uint32_t dropped;       /* submissions merged into a newer one before they went out */
+    uint32_t failed;        /* frames not sent, the BWR mode could not get its red plane */
+    uint32_t depth;         /* submissions waiting, 0 or 1 */
+} epaper_service_stats_t;
+
+/* SPI trace dump, see iot_epaper_trace_dump(). The header is followed by the
+ * records, oldest first, each an epaper_trace_record_t and the first
+ * `captured` bytes the transaction sent. Little endian, as the ESP32 writes it.
+ */
+#define E_PAPER_TRACE_MAGIC     0x52545045  /* "EPTR" */
+#define E_PAPER_TRACE_VERSION   1
+#define E_PAPER_TRACE_COMMAND   0x01        /* sent with the D/C line at dc_lev_cmd */
+#define E_PAPER_TRACE_TRUNCATED 0x02        /* captured is less than length */
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;   /* sizeof(epaper_trace_record_t) */
+    uint32_t records;
+    uint32_t dropped;       /* oldest records overwritten by newer ones */
+} epaper_trace_header_t;
+
+typedef struct
+{
+    uint32_t start_us;      /* esp_timer_get_time() when the transfer started, low 32 bits */
+    uint32_t duration_us;   /* 0 when the SPI device was not set up by the driver */
+    uint32_t length;        /* bytes sent */
+    uint16_t captured;      /* bytes of them that follow this record */
+    uint8_t dc_level;
+    uint8_t flags;          /* E_PAPER_TRACE_ flags */
+} epaper_trace_record_t;
+
 #define WHITE     0
 #define BLACK     1
 #define RED       2
@@ -69,6 +170,7 @@ typedef struct {
     epaper_rotate_t rotate;
     int width;
     int height;
+    epaper_area_t dirty;    /* changed since the last frame, in panel coordinates */
 } epaper_paint_t;
 
 /* EPD properties */
@@ -94,21 +196,53 @@ typedef struct {
     bool color_inv;
 
     bool fast_bw_mode;
+    bool bw_only;           /* with fast_bw_mode, no red plane while in fast B/W mode, see iot_epaper_set_mode() */
 } epaper_conf_t;
 
 typedef void* epaper_handle_t; /*handle of epaper*/
 
+/* Called by the driver task when a frame sent by iot_epaper_display_frame_async() is on screen */
+typedef void (*epaper_frame_done_cb_t)(epaper_handle_t dev, void* arg);
+
 /**
- * @brief Create and init epaper and return a epaper handle
+ * @brief Create and init epaper and return a epaper handle. The device and
+ *        its frame buffer planes are one DMA capable allocation, so frames
+ *        are sent without copying.
  *
  * @param bus handle of spi device
  * @param epconf configure struct for epaper device
  *
  * @return
  *     - handle of epaper
+ *     - NULL out of memory
  */
 epaper_handle_t iot_epaper_create(spi_device_handle_t bus, epaper_conf_t * epconf);
 
+/**
+ * @brief Create and init epaper in storage owned by the caller, see
+ *        iot_epaper_create(). iot_epaper_delete() leaves the storage alone.
+ *
+ * @param bus handle of spi device
+ * @param epconf configure struct for epaper device
+ * @param storage DMA capable, word aligned memory, e.g. a static buffer in internal RAM
+ * @param size bytes of storage, at least iot_epaper_get_storage_size()
+ *
+ * @return
+ *     - handle of epaper
+ *     - NULL storage too small, not aligned or not DMA capable
+ */
+epaper_handle_t iot_epaper_create_static(spi_device_handle_t bus, epaper_conf_t * epconf, void* storage, size_t size);
+
+/**
+ * @brief Get the storage iot_epaper_create_static() needs for a configuration
+ *
+ * @param epconf configure struct for epaper device
+ *
+ * @return
+ *     - bytes of storage
+ */
+size_t iot_epaper_get_storage_size(const epaper_conf_t * epconf);
+
 /**
  * @brief   delete epaper handle_t
  *
@@ -121,6 +255,28 @@ epaper_handle_t iot_epaper_create(spi_device_handle_t bus, epaper_conf_t * epcon
  */
 esp_err_t iot_epaper_delete(epaper_handle_t dev, bool del_bus);
 
+/**
+ * @brief   switch between the fast B/W and the full BWR mode (see
+ *          epaper_conf_t.fast_bw_mode) without recreating the device. Only the
+ *          controller registers and LUT are reloaded, the SPI bus, frame
+ *          buffers, rotation and handle are kept.
+ *
+ * @param dev object handle of epaper
+ * @param fast_bw_mode true for the fast B/W mode
+ *
+ * @note   A device created with epaper_conf_t.bw_only gets its red plane on
+ *         a switch to BWR, cleared to no red, and frees it on the switch back,
+ *         from then on what was drawn red shows white. Automatic full
+ *         refreshes switch the same way. Only such a device drops the red plane, any other
+ *         keeps it in fast B/W mode, where drawing still updates it but the
+ *         refreshes send the B/W plane only.
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_NO_MEM no memory for the red plane
+ */
+esp_err_t iot_epaper_set_mode(epaper_handle_t dev, bool fast_bw_mode);
+
 /**
  * @brief clear display frame buffer
  *
@@ -177,13 +333,25 @@ int iot_epaper_get_rotate(epaper_handle_t dev);
 void iot_epaper_set_rotate(epaper_handle_t dev, int rotate);
 
 /**
- * @brief get display data
+ * @brief get display data, the B/W plane of the frame buffer in panel
+ *        coordinates, width/8 bytes per row, MSB first, bit set = white
  * @param dev object handle of epaper
  * @return
  *     - Pointer to display data
  */
 unsigned char* iot_epaper_get_image(epaper_handle_t dev);
 
+/**
+ * @brief get the red plane of the frame buffer, laid out like
+ *        iot_epaper_get_image(), bit set = red
+ * @param dev object handle of epaper
+ * @return
+ *     - Pointer to the red plane
+ *     - NULL when the device has no red plane (bw_only in fast B/W mode),
+ *       the pointer of a bw_only device is only valid until it switches back
+ */
+unsigned char* iot_epaper_get_red_image(epaper_handle_t dev);
+
 /**
  * @brief   draw string start on point(x,y) and save on display data array,
  *          screen will display when call iot_epaper_display_frame function.
@@ -220,6 +388,30 @@ void iot_epaper_draw_pixel(epaper_handle_t dev, int x, int y, int colored);
 void iot_epaper_draw_char(epaper_handle_t dev, int x, int y, char ascii_char,
         epaper_font_t* font, int colored);
 
+/**
+ * @brief   set up the cache of glyphs pre-rotated for E_PAPER_ROTATE_90.
+ *          Each glyph drawn in that rotation is transposed once into the
+ *          panel's byte layout and then copied as whole bytes. The least
+ *          recently used glyphs are dropped to stay within the budget.
+ *          Calling it again empties the cache and clears the counters.
+ *
+ * @param   dev object handle of epaper
+ * @param   budget bytes the cache may allocate, 0 to disable it
+ *          (an epaper_font_60 glyph takes about 550 bytes)
+ *
+ * @return
+ *     - ESP_OK Success
+ */
+esp_err_t iot_epaper_set_glyph_cache(epaper_handle_t dev, size_t budget);
+
+/**
+ * @brief   get the glyph cache counters, used to size the cache budget
+ *
+ * @param   dev object handle of epaper
+ * @param   stats output, counters since the last iot_epaper_set_glyph_cache()
+ */
+void iot_epaper_get_glyph_cache_stats(epaper_handle_t dev, epaper_glyph_cache_stats_t* stats);
+
 /**
  * @brief   draw line start on point(x0,y0) end on point(x1,y1) and save on display data array,
  *          screen will display when call iot_epaper_display_frame function.
@@ -311,12 +503,115 @@ void iot_epaper_draw_circle(epaper_handle_t dev, int x, int y, int radius,
 void iot_epaper_draw_filled_circle(epaper_handle_t dev, int x, int y,
         int radius, int colored);
 
+/**
+ * @brief   draw a fill ellipse centred at point(x,y) and save on display data array,
+ *          screen will display when call iot_epaper_display_frame function.
+ *
+ * @param  dev object handle of epaper
+ * @param  x point(x,y)
+ * @param  y point(x,y)
+ * @param  x_radius radius along the x axis
+ * @param  y_radius radius along the y axis
+ * @param  colored display color
+ */
+void iot_epaper_draw_filled_ellipse(epaper_handle_t dev, int x, int y,
+        int x_radius, int y_radius, int colored);
+
+/**
+ * @brief   get the area of the frame buffer changed by drawing calls since the
+ *          last iot_epaper_display_frame() or iot_epaper_reset_dirty_area() call.
+ *          The area is given in the coordinates of the current rotation.
+ *
+ * @param  dev object handle of epaper
+ * @param  area output, bounding box of the changed pixels
+ *
+ * @return
+ *     - true if something was drawn, false if the frame buffer is unchanged
+ */
+bool iot_epaper_get_dirty_area(epaper_handle_t dev, epaper_area_t* area);
+
+/**
+ * @brief   forget about the changes made to the frame buffer so far
+ *
+ * @param  dev object handle of epaper
+ */
+void iot_epaper_reset_dirty_area(epaper_handle_t dev);
+
 /**
  * @brief  wait until idle
  * @param  dev object handle of epaper
+ *
+ * @note   The wait is woken by the busy pin interrupt and gives up after 30 s.
+ *         A frame in flight, see iot_epaper_display_frame_async(), is waited
+ *         for first.
  */
 void iot_epaper_wait_idle(epaper_handle_t dev);
 
+/**
+ * @brief   get how long the panel was busy for an operation
+ *
+ * @param  dev object handle of epaper
+ * @param  op operation
+ * @param  stats output, durations since the device was created
+ *
+ * @note   last_wake_us and max_wake_us time the busy pin interrupt, from the
+ *         edge to the waiting task running. They stay 0 while the pin is polled.
+ */
+void iot_epaper_get_busy_stats(epaper_handle_t dev, epaper_busy_op_t op, epaper_busy_stats_t* stats);
+
+/**
+ * @brief   get the performance counters of the device, accumulated since it
+ *          was created. Cheap enough to call after every frame, the
+ *          difference of two calls is the cost of what was done in between.
+ *
+ * @param  dev object handle of epaper
+ * @param  stats output
+ */
+void iot_epaper_get_stats(epaper_handle_t dev, epaper_stats_t* stats);
+
+/**
+ * @brief   add a waveform to the LUT registry
+ *
+ * @param  dev object handle of epaper
+ * @param  lut content of the LUT register (70 bytes for this panel), in flash
+ *             or in memory that stays valid while the device exists
+ * @param  size bytes in lut
+ * @param  lut_id output, id to pass to iot_epaper_select_lut()
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_ARG lut or lut_id NULL, or size 0
+ *     - ESP_ERR_NO_MEM the registry is full
+ */
+esp_err_t iot_epaper_register_lut(epaper_handle_t dev, const uint8_t* lut, size_t size, int* lut_id);
+
+/**
+ * @brief   select the waveform of the next refreshes in fast B/W mode. The LUT
+ *          is uploaded with the next refresh, only if the controller does not
+ *          have it loaded already. BWR mode always uses the OTP waveform.
+ *
+ * @param  dev object handle of epaper
+ * @param  lut_id E_PAPER_LUT_FULL, E_PAPER_LUT_PARTIAL or an id from iot_epaper_register_lut()
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_ARG unknown lut_id
+ */
+esp_err_t iot_epaper_select_lut(epaper_handle_t dev, int lut_id);
+
+/**
+ * @brief   get the busy durations of the refreshes made with a waveform
+ *
+ * @param  dev object handle of epaper
+ * @param  lut_id waveform id
+ * @param  stats output
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_ARG unknown lut_id
+ */
+esp_err_t iot_epaper_get_lut_stats(epaper_handle_t dev, int lut_id, epaper_busy_stats_t* stats);
+
 /**
  * @brief  reset device
  *
@@ -325,12 +620,245 @@ void iot_epaper_wait_idle(epaper_handle_t dev);
 void iot_epaper_reset(epaper_handle_t dev);
 
 /**
- * @brief dispaly frame, refresh screen
+ * @brief dispaly frame, refresh screen, and reset the dirty area
  *
  * @param dev object handle of epaper
  */
 void iot_epaper_display_frame(epaper_handle_t dev);
 
+/**
+ * @brief   dispaly frame without waiting for the refresh. The planes are queued
+ *          to the SPI DMA and the call returns, a driver task waits for the
+ *          panel to be idle again and then calls done_cb.
+ *
+ * @param  dev object handle of epaper
+ * @param  done_cb called from the driver task when the refresh is over, may be NULL
+ * @param  arg passed to done_cb
+ *
+ * @note   The frame sent is the frame buffer as it is at the time of the call.
+ *         Drawing calls block until both planes have been sent (a few ms) and
+ *         other calls using the SPI bus until the refresh is over. A call made
+ *         while a previous frame is in flight waits for it first, so it must not
+ *         be made from done_cb. done_cb runs on the driver task, whose stack
+ *         of CONFIG_EPAPER_ASYNC_TASK_STACK bytes (4096 by default) the frame
+ *         push and the refresh wait use too, it should only signal the
+ *         application.
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_NO_MEM the driver task could not be created
+ */
+esp_err_t iot_epaper_display_frame_async(epaper_handle_t dev, epaper_frame_done_cb_t done_cb, void* arg);
+
+/**
+ * @brief   wait for the frame sent by iot_epaper_display_frame_async() to be on screen
+ *
+ * @param  dev object handle of epaper
+ * @param  ticks_to_wait how long to wait, 0 to poll
+ *
+ * @return
+ *     - ESP_OK no frame in flight
+ *     - ESP_ERR_TIMEOUT the refresh is not over yet
+ */
+esp_err_t iot_epaper_wait_frame_done(epaper_handle_t dev, TickType_t ticks_to_wait);
+
+/**
+ * @brief   allocate (or free) a second pair of planes for iot_epaper_swap_frame()
+ *
+ * @param  dev object handle of epaper
+ * @param  enable true to allocate, false to free
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_NO_MEM out of memory
+ */
+esp_err_t iot_epaper_set_double_buffer(epaper_handle_t dev, bool enable);
+
+/**
+ * @brief   display the frame buffer without waiting for it, then keep drawing
+ *          in the second pair of planes. The planes drawn so far are handed to
+ *          the driver task, which sends them and waits for the refresh. The
+ *          frame buffer switches to the other pair, which starts as a copy of
+ *          the frame sent, so drawing never waits for the SPI or the panel.
+ *
+ * @param  dev object handle of epaper
+ * @param  done_cb called from the driver task when the refresh is over, may be NULL
+ * @param  arg passed to done_cb
+ * @param  ticks_to_wait how long to wait for the previous frame to be on screen,
+ *         its planes are not given back before that
+ *
+ * @note   The pointer returned by iot_epaper_get_image() changes with every
+ *         swap, a pointer kept from before belongs to the driver task.
+ *         done_cb runs on the stack of the driver task, see
+ *         iot_epaper_display_frame_async().
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_STATE double buffering is not enabled
+ *     - ESP_ERR_TIMEOUT the previous frame is still in flight
+ *     - ESP_ERR_NO_MEM the driver task could not be created
+ */
+esp_err_t iot_epaper_swap_frame(epaper_handle_t dev, epaper_frame_done_cb_t done_cb, void* arg, TickType_t ticks_to_wait);
+
+/**
+ * @brief   refresh screen from a part of the frame buffer only. Only the
+ *          controller RAM window covering the area is written, the rest of the
+ *          screen keeps the content it was last given.
+ *
+ * @param  dev object handle of epaper
+ * @param  x0 point(x0,y0)
+ * @param  y0 point(x0,y0)
+ * @param  x1 point(x1,y1)
+ * @param  y1 point(x1,y1)
+ *
+ * @note   Points are in the coordinates of the current rotation. The area is
+ *         widened to whole bytes of the controller RAM, which are 8 pixels along
+ *         the panel width (the Y axis when rotated by 90 or 270 degrees).
+ */
+void iot_epaper_display_region(epaper_handle_t dev, int x0, int y0, int x1, int y1);
+
+/**
+ * @brief   set how many fast refreshes a region of the screen may take before
+ *          ghosting calls for a full BWR refresh. Fast refreshes are counted
+ *          in a grid of regions where the frame changed, a BWR refresh clears
+ *          them all.
+ *
+ * @param  dev object handle of epaper
+ * @param  budget fast refreshes per region, 0 for no limit (the default)
+ * @param  auto_refresh true to have iot_epaper_display_frame() and
+ *         iot_epaper_display_region() follow the fast refresh that uses up the
+ *         budget with a BWR refresh of the whole frame buffer, false to leave
+ *         it to the application (see iot_epaper_full_refresh_due())
+ *
+ * @note   With auto_refresh the frame buffer must hold the whole screen, not
+ *         only the part that was refreshed last.
+ */
+void iot_epaper_set_ghosting_budget(epaper_handle_t dev, int budget, bool auto_refresh);
+
+/**
+ * @brief   whether a region of the screen used up its fast refresh budget
+ *
+ * @param  dev object handle of epaper
+ *
+ * @return
+ *     - true if a full BWR refresh is due
+ */
+bool iot_epaper_full_refresh_due(epaper_handle_t dev);
+
+/**
+ * @brief   get the fast refreshes taken since the last full refresh by the
+ *          region of the screen that took most
+ *
+ * @param  dev object handle of epaper
+ * @return
+ *     - fast refresh count
+ */
+int iot_epaper_get_fast_refresh_count(epaper_handle_t dev);
+
+/**
+ * @brief   start the display service, a task that pushes submitted frames so
+ *          the application never waits for a refresh. It takes two frame
+ *          snapshots of memory, 2 planes, 4 while the device has a red plane.
+ *
+ * @param  dev object handle of epaper
+ *
+ * @note   Once started, frames should go through iot_epaper_submit_frame() and
+ *         iot_epaper_submit_region() and the service sets the panel mode.
+ *         The task stack is CONFIG_EPAPER_SERVICE_TASK_STACK bytes.
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_NO_MEM out of memory
+ */
+esp_err_t iot_epaper_service_start(epaper_handle_t dev);
+
+/**
+ * @brief   submit the frame buffer to the display service and return. The
+ *          frame buffer is copied, drawing may go on right away. If the
+ *          previous submission has not gone out yet, only the newest content
+ *          is pushed, in one refresh covering both. A BWR frame is dropped
+ *          and counted as failed when the red plane cannot be allocated.
+ *
+ * @param  dev object handle of epaper
+ * @param  fast_bw_mode refresh in fast B/W mode, or in BWR mode
+ *
+ * @note   A bw_only device only draws red after iot_epaper_set_mode()
+ *         switched it to BWR, the next fast frame pushed frees the red plane.
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_STATE the service is not started
+ */
+esp_err_t iot_epaper_submit_frame(epaper_handle_t dev, bool fast_bw_mode);
+
+/**
+ * @brief   submit a part of the frame buffer to the display service, see
+ *          iot_epaper_submit_frame() and iot_epaper_display_region()
+ *
+ * @param  dev object handle of epaper
+ * @param  x0 point(x0,y0)
+ * @param  y0 point(x0,y0)
+ * @param  x1 point(x1,y1)
+ * @param  y1 point(x1,y1)
+ * @param  fast_bw_mode refresh in fast B/W mode, or in BWR mode
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_ARG the area is off the screen
+ *     - ESP_ERR_INVALID_STATE the service is not started
+ */
+esp_err_t iot_epaper_submit_region(epaper_handle_t dev, int x0, int y0, int x1, int y1, bool fast_bw_mode);
+
+/**
+ * @brief   get the display service counters
+ *
+ * @param  dev object handle of epaper
+ * @param  stats output
+ */
+void iot_epaper_get_service_stats(epaper_handle_t dev, epaper_service_stats_t* stats);
+
+/**
+ * @brief   start recording every SPI transaction sent to the panel into a RAM
+ *          ring buffer of CONFIG_EPAPER_SPI_TRACE_BUFFER_SIZE bytes, the oldest
+ *          records are overwritten when it is full. A running trace is
+ *          cleared. Needs CONFIG_EPAPER_SPI_TRACE.
+ *
+ * @param  dev object handle of epaper
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_NO_MEM no memory for the buffer
+ *     - ESP_ERR_NOT_SUPPORTED tracing is not enabled in the configuration
+ */
+esp_err_t iot_epaper_trace_start(epaper_handle_t dev);
+
+/**
+ * @brief   stop recording, the trace is kept for iot_epaper_trace_dump()
+ *
+ * @param  dev object handle of epaper
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_NOT_SUPPORTED tracing is not enabled in the configuration
+ */
+esp_err_t iot_epaper_trace_stop(epaper_handle_t dev);
+
+/**
+ * @brief   write the trace, an epaper_trace_header_t and the records. Binary
+ *          for a file, e.g. on the SD card, or as EPTRACE: lines of hex for
+ *          the console. host/trace_replay.c reads both.
+ *
+ * @param  dev object handle of epaper
+ * @param  out stream to write to
+ * @param  hex true to write hex lines instead of binary
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_FAIL writing failed
+ *     - ESP_ERR_NOT_SUPPORTED tracing is not enabled in the configuration
+ */
+esp_err_t iot_epaper_trace_dump(epaper_handle_t dev, FILE* out, bool hex);
+
 /**
  * @brief   After this command is transmitted, the chip would enter the deep-sleep mode to save power.
  * The deep sleep mode would return to standby by hardware reset. The only one parameter is a
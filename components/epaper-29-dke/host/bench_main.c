@@ -0,0 +1,50 @@
+// Host runner of the drawing benchmarks in ../bench, on the emulated panel.
+// usage: epaper_bench [repeat]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "epaper-29-dke.h"
+#include "epaper_emu.h"
+#include "epaper_bench.h"
+
+int main(int argc, char** argv)
+{
+    uint32_t repeat = argc > 1 ? strtoul(argv[1], NULL, 0) : 10;
+    epaper_emu_config_t emu_conf = {
+        .dc_pin = 25,
+        .busy_pin = 35,
+        .busy_active_level = 1,
+        .dc_lev_cmd = 0,
+        .refresh_us = 0,
+    };
+    epaper_conf_t epaper_conf = {
+        .busy_pin = 35,
+        .cs_pin = 27,
+        .dc_pin = 25,
+        .miso_pin = -1,
+        .mosi_pin = 13,
+        .reset_pin = 26,
+        .sck_pin = 14,
+        .rst_active_level = 0,
+        .busy_active_level = 1,
+        .dc_lev_data = 1,
+        .dc_lev_cmd = 0,
+        .clk_freq_hz = 20 * 1000 * 1000,
+        .spi_host = HSPI_HOST,
+        .width = EPD_WIDTH,
+        .height = EPD_HEIGHT,
+        .color_inv = 1,
+        .fast_bw_mode = false,
+    };
+    epaper_handle_t device;
+
+    epaper_emu_config(&emu_conf);
+    device = iot_epaper_create(NULL, &epaper_conf);
+    if (device == NULL) {
+        fprintf(stderr, "iot_epaper_create failed\n");
+        return 1;
+    }
+    epaper_bench_run(device, repeat ? repeat : 1, NULL, NULL);
+    iot_epaper_delete(device, true);
+    return 0;
+}
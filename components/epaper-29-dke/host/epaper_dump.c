@@ -0,0 +1,102 @@
+// Renders the base-full-refresh demo scene through the driver into the
+// emulated controller and writes the panel RAM as images:
+//   <dir>/demo_bw.pbm, <dir>/demo_red.pbm and <dir>/demo.ppm
+// and the SPI trace of the frame as <dir>/demo.trc, for epaper_replay.
+
+#include <stdio.h>
+#include <string.h>
+#include "epaper-29-dke.h"
+#include "epaper_fonts.h"
+#include "epaper_emu.h"
+
+#define DC_PIN      25
+#define BUSY_PIN    35
+
+int main(int argc, char** argv)
+{
+    const char* dir = argc > 1 ? argv[1] : ".";
+    char path[256];
+    epaper_emu_config_t emu_conf = {
+        .dc_pin = DC_PIN,
+        .busy_pin = BUSY_PIN,
+        .busy_active_level = 1,
+        .dc_lev_cmd = 0,
+        .refresh_us = 0,
+    };
+    epaper_conf_t epaper_conf = {
+        .busy_pin = BUSY_PIN,
+        .cs_pin = 27,
+        .dc_pin = DC_PIN,
+        .miso_pin = -1,
+        .mosi_pin = 13,
+        .reset_pin = 26,
+        .sck_pin = 14,
+
+        .rst_active_level = 0,
+        .busy_active_level = 1,
+
+        .dc_lev_data = 1,
+        .dc_lev_cmd = 0,
+
+        .clk_freq_hz = 20 * 1000 * 1000,
+        .spi_host = HSPI_HOST,
+
+        .width = EPD_WIDTH,
+        .height = EPD_HEIGHT,
+        .color_inv = 1,
+        .fast_bw_mode = false,
+    };
+    epaper_handle_t device;
+
+    epaper_emu_config(&emu_conf);
+    epaper_emu_reset();
+    device = iot_epaper_create(NULL, &epaper_conf);
+    if (device == NULL) {
+        fprintf(stderr, "iot_epaper_create failed\n");
+        return 1;
+    }
+    if (iot_epaper_trace_start(device) != ESP_OK) {
+        fprintf(stderr, "iot_epaper_trace_start failed\n");
+        return 1;
+    }
+    iot_epaper_set_rotate(device, E_PAPER_ROTATE_90);
+    iot_epaper_clean_paint(device, WHITE);
+    iot_epaper_draw_string(device, 75, 10, "EPAPER DEMO", &epaper_font_20, RED);
+    iot_epaper_draw_string(device, 40, 35, "DEPG0290RHS75BF6CP-H0", &epaper_font_16, BLACK);
+    iot_epaper_draw_line(device, 10, 55, 150, 70, BLACK);
+    iot_epaper_draw_filled_rectangle(device, 160, 55, 280, 70, RED);
+    iot_epaper_draw_filled_circle(device, 80, 100, 50, BLACK);
+    iot_epaper_draw_circle(device, 200, 100, 20, RED);
+    iot_epaper_display_frame(device);
+
+    const epaper_emu_stats_t* stats = epaper_emu_get_stats();
+    printf("%u SPI transactions, %u bytes, %u refreshes\n", stats->transactions, stats->bytes, stats->refreshes);
+    epaper_stats_t counters;
+    iot_epaper_get_stats(device, &counters);
+    printf("driver counters: %u transactions, %llu bytes, %u full and %u fast refreshes, "
+           "render %llu us in %u calls, last refresh %u us\n",
+           counters.spi_transactions, (unsigned long long) counters.spi_bytes,
+           counters.full_refreshes, counters.fast_refreshes,
+           (unsigned long long) counters.render_us, counters.render_calls, counters.last_refresh_us);
+
+    snprintf(path, sizeof(path), "%s/demo_bw.pbm", dir);
+    if (epaper_emu_write_pbm(path, EPAPER_EMU_RAM_BW) != 0) {
+        fprintf(stderr, "cannot write %s\n", path);
+        return 1;
+    }
+    snprintf(path, sizeof(path), "%s/demo_red.pbm", dir);
+    epaper_emu_write_pbm(path, EPAPER_EMU_RAM_RED);
+    snprintf(path, sizeof(path), "%s/demo.ppm", dir);
+    epaper_emu_write_ppm(path);
+    snprintf(path, sizeof(path), "%s/demo.trc", dir);
+    FILE* trace = fopen(path, "wb");
+    if (trace == NULL || iot_epaper_trace_dump(device, trace, false) != ESP_OK) {
+        fprintf(stderr, "cannot write %s\n", path);
+        return 1;
+    }
+    fclose(trace);
+    printf("panel RAM written to %s\n", dir);
+
+    iot_epaper_delete(device, true);
+    return 0;
+}
@@ -0,0 +1,369 @@
+// Emulated SSD16xx-like controller of the 2.9" panel behind the host spi_master
+// and gpio shims. It keeps both RAM planes, the RAM window and address counter
+// set by 0x44/0x45/0x4E/0x4F, and raises BUSY for a while after 0x20.
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "esp_timer.h"
+#include "driver/gpio.h"
+#include "driver/spi_master.h"
+#include "epaper_emu.h"
+
+#define EMU_GPIO_COUNT  48
+#define EMU_MAX_PARAMS  256
+
+static epaper_emu_config_t s_cfg = {
+    .dc_pin = 25,
+    .busy_pin = 35,
+    .busy_active_level = 1,
+    .dc_lev_cmd = 0,
+    .refresh_us = 0,
+};
+
+static int s_gpio_level[EMU_GPIO_COUNT];
+static gpio_isr_t s_isr[EMU_GPIO_COUNT];
+static void *s_isr_arg[EMU_GPIO_COUNT];
+static int s_isr_enabled[EMU_GPIO_COUNT];
+/* end of the busy period, read by the driver and the release threads */
+static int64_t s_busy_until;
+static pthread_mutex_t s_busy_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct {
+    uint8_t ram[2][EPAPER_EMU_RAM_SIZE];
+    uint8_t cmd;
+    uint8_t params[EMU_MAX_PARAMS];
+    int nparams;
+    int x_start, x_end, y_start, y_end;
+    int x, y;
+} s_ctl;
+
+static epaper_emu_stats_t s_stats;
+
+struct spi_device_t {
+    spi_device_interface_config_t cfg;
+    spi_transaction_t *queue[64];
+    int head, count;
+};
+
+void epaper_emu_config(const epaper_emu_config_t *cfg)
+{
+    s_cfg = *cfg;
+}
+
+void epaper_emu_reset(void)
+{
+    memset(&s_ctl, 0, sizeof(s_ctl));
+    s_ctl.x_end = EPAPER_EMU_ROW_BYTES - 1;
+    s_ctl.y_end = EPAPER_EMU_RAM_HEIGHT - 1;
+    pthread_mutex_lock(&s_busy_lock);
+    s_busy_until = 0;
+    pthread_mutex_unlock(&s_busy_lock);
+}
+
+const uint8_t *epaper_emu_ram(epaper_emu_ram_t ram)
+{
+    return s_ctl.ram[ram];
+}
+
+const epaper_emu_stats_t *epaper_emu_get_stats(void)
+{
+    return &s_stats;
+}
+
+void epaper_emu_clear_stats(void)
+{
+    memset(&s_stats, 0, sizeof(s_stats));
+}
+
+static int64_t emu_busy_until(void)
+{
+    pthread_mutex_lock(&s_busy_lock);
+    int64_t until = s_busy_until;
+    pthread_mutex_unlock(&s_busy_lock);
+    return until;
+}
+
+static void *emu_busy_release(void *arg)
+{
+    (void)arg;
+    int64_t now = esp_timer_get_time();
+    int64_t until = emu_busy_until();
+    if (until > now) {
+        usleep((useconds_t)(until - now));
+    }
+    int pin = s_cfg.busy_pin;
+    if (s_isr[pin] && s_isr_enabled[pin]) {
+        s_isr[pin](s_isr_arg[pin]);
+    }
+    return NULL;
+}
+
+static void emu_set_busy(uint32_t us)
+{
+    if (us == 0) {
+        return;
+    }
+    pthread_t t;
+    pthread_mutex_lock(&s_busy_lock);
+    s_busy_until = esp_timer_get_time() + us;
+    pthread_mutex_unlock(&s_busy_lock);
+    pthread_create(&t, NULL, emu_busy_release, NULL);
+    pthread_detach(t);
+}
+
+static void emu_ram_write(uint8_t data)
+{
+    int plane = s_ctl.cmd == 0x24 ? EPAPER_EMU_RAM_BW : EPAPER_EMU_RAM_RED;
+    if (s_ctl.x >= 0 && s_ctl.x < EPAPER_EMU_ROW_BYTES && s_ctl.y >= 0 && s_ctl.y < EPAPER_EMU_RAM_HEIGHT) {
+        s_ctl.ram[plane][s_ctl.y * EPAPER_EMU_ROW_BYTES + s_ctl.x] = data;
+    }
+    s_stats.ram_bytes_written++;
+    /* data entry mode 0x03: X increments first, then Y */
+    if (++s_ctl.x > s_ctl.x_end) {
+        s_ctl.x = s_ctl.x_start;
+        if (++s_ctl.y > s_ctl.y_end) {
+            s_ctl.y = s_ctl.y_start;
+        }
+    }
+}
+
+static void emu_param(uint8_t data)
+{
+    if (s_ctl.nparams < EMU_MAX_PARAMS) {
+        s_ctl.params[s_ctl.nparams] = data;
+    }
+    s_ctl.nparams++;
+    const uint8_t *p = s_ctl.params;
+    switch (s_ctl.cmd) {
+    case 0x44:
+        if (s_ctl.nparams == 1) {
+            s_ctl.x_start = p[0] & 0x3f;
+        } else if (s_ctl.nparams == 2) {
+            s_ctl.x_end = p[1] & 0x3f;
+        }
+        break;
+    case 0x45:
+        if (s_ctl.nparams == 2) {
+            s_ctl.y_start = p[0] | ((p[1] & 1) << 8);
+        } else if (s_ctl.nparams == 4) {
+            s_ctl.y_end = p[2] | ((p[3] & 1) << 8);
+        }
+        break;
+    case 0x4E:
+        if (s_ctl.nparams == 1) {
+            s_ctl.x = p[0] & 0x3f;
+        }
+        break;
+    case 0x4F:
+        if (s_ctl.nparams == 2) {
+            s_ctl.y = p[0] | ((p[1] & 1) << 8);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void emu_command(uint8_t cmd)
+{
+    s_ctl.cmd = cmd;
+    s_ctl.nparams = 0;
+    s_stats.commands++;
+    switch (cmd) {
+    case 0x12:  /* SW reset */
+        s_ctl.x_start = s_ctl.y_start = s_ctl.x = s_ctl.y = 0;
+        s_ctl.x_end = EPAPER_EMU_ROW_BYTES - 1;
+        s_ctl.y_end = EPAPER_EMU_RAM_HEIGHT - 1;
+        break;
+    case 0x20:  /* master activation */
+        s_stats.refreshes++;
+        emu_set_busy(s_cfg.refresh_us);
+        break;
+    case 0x32:
+        s_stats.lut_uploads++;
+        break;
+    default:
+        break;
+    }
+}
+
+void epaper_emu_write(int is_cmd, const uint8_t *data, int len)
+{
+    s_stats.transactions++;
+    s_stats.bytes += len;
+    for (int i = 0; i < len; i++) {
+        if (is_cmd) {
+            emu_command(data[i]);
+        } else if (s_ctl.cmd == 0x24 || s_ctl.cmd == 0x26) {
+            emu_ram_write(data[i]);
+        } else {
+            emu_param(data[i]);
+        }
+    }
+}
+
+static void emu_transfer(spi_device_handle_t dev, spi_transaction_t *t)
+{
+    if (dev->cfg.pre_cb) {
+        dev->cfg.pre_cb(t);
+    }
+    const uint8_t *data = (t->flags & SPI_TRANS_USE_TXDATA) ? t->tx_data : t->tx_buffer;
+    epaper_emu_write(s_gpio_level[s_cfg.dc_pin] == s_cfg.dc_lev_cmd, data, t->length / 8);
+    if (dev->cfg.post_cb) {
+        dev->cfg.post_cb(t);
+    }
+}
+
+int epaper_emu_write_pbm(const char *path, epaper_emu_ram_t ram)
+{
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        return -1;
+    }
+    /* PBM: 1 = black. Panel RAM: bit set = white (B/W plane) or red (red plane) */
+    fprintf(f, "P4\n%d %d\n", EPAPER_EMU_RAM_WIDTH, EPAPER_EMU_RAM_HEIGHT);
+    for (int i = 0; i < EPAPER_EMU_RAM_SIZE; i++) {
+        uint8_t b = s_ctl.ram[ram][i];
+        fputc(ram == EPAPER_EMU_RAM_BW ? (uint8_t)~b : b, f);
+    }
+    fclose(f);
+    return 0;
+}
+
+int epaper_emu_write_ppm(const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        return -1;
+    }
+    fprintf(f, "P6\n%d %d\n255\n", EPAPER_EMU_RAM_WIDTH, EPAPER_EMU_RAM_HEIGHT);
+    for (int i = 0; i < EPAPER_EMU_RAM_WIDTH * EPAPER_EMU_RAM_HEIGHT; i++) {
+        uint8_t mask = 0x80 >> (i % 8);
+        int white = s_ctl.ram[EPAPER_EMU_RAM_BW][i / 8] & mask;
+        int red = s_ctl.ram[EPAPER_EMU_RAM_RED][i / 8] & mask;
+        uint8_t rgb[3] = { 0, 0, 0 };
+        if (red) {
+            rgb[0] = 255;
+        } else if (white) {
+            rgb[0] = rgb[1] = rgb[2] = 255;
+        }
+        fwrite(rgb, 1, 3, f);
+    }
+    fclose(f);
+    return 0;
+}
+
+/* GPIO */
+void gpio_pad_select_gpio(int gpio) { (void)gpio; }
+esp_err_t gpio_set_direction(gpio_num_t gpio, gpio_mode_t mode) { (void)gpio; (void)mode; return ESP_OK; }
+esp_err_t gpio_set_pull_mode(gpio_num_t gpio, gpio_pull_mode_t pull) { (void)gpio; (void)pull; return ESP_OK; }
+esp_err_t gpio_set_intr_type(gpio_num_t gpio, gpio_int_type_t type) { (void)gpio; (void)type; return ESP_OK; }
+esp_err_t gpio_install_isr_service(int flags) { (void)flags; return ESP_OK; }
+
+esp_err_t gpio_set_level(gpio_num_t gpio, uint32_t level)
+{
+    if (gpio >= 0 && gpio < EMU_GPIO_COUNT) {
+        s_gpio_level[gpio] = level & 1;
+    }
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio)
+{
+    if (gpio == s_cfg.busy_pin) {
+        int busy = esp_timer_get_time() < emu_busy_until();
+        return busy ? s_cfg.busy_active_level : !s_cfg.busy_active_level;
+    }
+    return (gpio >= 0 && gpio < EMU_GPIO_COUNT) ? s_gpio_level[gpio] : 0;
+}
+
+esp_err_t gpio_intr_enable(gpio_num_t gpio) { s_isr_enabled[gpio] = 1; return ESP_OK; }
+esp_err_t gpio_intr_disable(gpio_num_t gpio) { s_isr_enabled[gpio] = 0; return ESP_OK; }
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio, gpio_isr_t isr, void *arg)
+{
+    s_isr[gpio] = isr;
+    s_isr_arg[gpio] = arg;
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t gpio)
+{
+    s_isr[gpio] = NULL;
+    return ESP_OK;
+}
+
+/* SPI master */
+esp_err_t spi_bus_initialize(spi_host_device_t host, const spi_bus_config_t *cfg, int dma_chan)
+{
+    (void)host; (void)cfg; (void)dma_chan;
+    return ESP_OK;
+}
+
+esp_err_t spi_bus_free(spi_host_device_t host)
+{
+    (void)host;
+    return ESP_OK;
+}
+
+esp_err_t spi_bus_add_device(spi_host_device_t host, const spi_device_interface_config_t *cfg, spi_device_handle_t *handle)
+{
+    (void)host;
+    spi_device_handle_t dev = calloc(1, sizeof(*dev));
+    dev->cfg = *cfg;
+    *handle = dev;
+    return ESP_OK;
+}
+
+esp_err_t spi_bus_remove_device(spi_device_handle_t handle)
+{
+    assert(handle->count == 0);
+    free(handle);
+    return ESP_OK;
+}
+
+esp_err_t spi_device_queue_trans(spi_device_handle_t handle, spi_transaction_t *t, TickType_t ticks)
+{
+    (void)ticks;
+    if (handle->count >= handle->cfg.queue_size) {
+        return ESP_ERR_TIMEOUT;
+    }
+    /* transfers complete immediately; results are collected in order */
+    emu_transfer(handle, t);
+    handle->queue[(handle->head + handle->count) % 64] = t;
+    handle->count++;
+    return ESP_OK;
+}
+
+esp_err_t spi_device_get_trans_result(spi_device_handle_t handle, spi_transaction_t **t, TickType_t ticks)
+{
+    (void)ticks;
+    if (handle->count == 0) {
+        return ESP_ERR_TIMEOUT;
+    }
+    *t = handle->queue[handle->head];
+    handle->head = (handle->head + 1) % 64;
+    handle->count--;
+    return ESP_OK;
+}
+
+esp_err_t spi_device_transmit(spi_device_handle_t handle, spi_transaction_t *t)
+{
+    spi_transaction_t *r;
+    /* same restriction as ESP-IDF: no other queued transactions may be pending */
+    assert(handle->count == 0);
+    esp_err_t ret = spi_device_queue_trans(handle, t, portMAX_DELAY);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    ret = spi_device_get_trans_result(handle, &r, portMAX_DELAY);
+    assert(r == t);
+    return ret;
+}
+
+esp_err_t spi_device_polling_transmit(spi_device_handle_t handle, spi_transaction_t *t)
+{
+    return spi_device_transmit(handle, t);
+}
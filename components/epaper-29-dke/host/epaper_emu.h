@@ -0,0 +1,47 @@
+// Emulated panel controller for the host build, see epaper_emu.c
+
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+
+#define EPAPER_EMU_RAM_WIDTH    128
+#define EPAPER_EMU_RAM_HEIGHT   296
+#define EPAPER_EMU_ROW_BYTES    (EPAPER_EMU_RAM_WIDTH / 8)
+#define EPAPER_EMU_RAM_SIZE     (EPAPER_EMU_ROW_BYTES * EPAPER_EMU_RAM_HEIGHT)
+
+typedef enum {
+    EPAPER_EMU_RAM_BW = 0,  /* written by 0x24 */
+    EPAPER_EMU_RAM_RED,     /* written by 0x26 */
+} epaper_emu_ram_t;
+
+typedef struct {
+    uint32_t transactions;
+    uint32_t bytes;
+    uint32_t commands;
+    uint32_t refreshes;
+    uint32_t ram_bytes_written;
+    uint32_t lut_uploads;
+} epaper_emu_stats_t;
+
+typedef struct {
+    int dc_pin;
+    int busy_pin;
+    int busy_active_level;
+    int dc_lev_cmd;
+    uint32_t refresh_us;    /* how long busy stays asserted after master activation */
+} epaper_emu_config_t;
+
+/* set the pins and timing, before iot_epaper_create() */
+void epaper_emu_config(const epaper_emu_config_t *cfg);
+/* power-on state, RAM cleared */
+void epaper_emu_reset(void);
+/* controller RAM, EPAPER_EMU_RAM_SIZE bytes, rows of 128 pixels MSB first */
+const uint8_t *epaper_emu_ram(epaper_emu_ram_t ram);
+/* one transaction as if it came over SPI, a command byte or data and parameters */
+void epaper_emu_write(int is_cmd, const uint8_t *data, int len);
+const epaper_emu_stats_t *epaper_emu_get_stats(void);
+void epaper_emu_clear_stats(void);
+/* one plane as a PBM image, black where the panel shows black (B/W) or red (red plane) */
+int epaper_emu_write_pbm(const char *path, epaper_emu_ram_t ram);
+/* what the panel shows, white, black and red, as a PPM image */
+int epaper_emu_write_ppm(const char *path);
@@ -0,0 +1,336 @@
+// Golden-image regression test for the raster path. Renders canonical scenes
+// into the frame buffer and compares bw_image/r_image bit-exactly against the
+// reference images in golden/:
+//
+//   epaper_golden <golden dir>            compare, exit 1 on any difference
+//   epaper_golden --update <golden dir>   rewrite the references
+//
+// A reference is a PBM of the panel RAM layout (128 x 296), the B/W plane on
+// top (1 = black) and the red plane below it (1 = red), 128 x 592 in total.
+// On a mismatch the rendered frame is written as <name>.actual.pbm to the
+// current directory. Each frame is also pushed with iot_epaper_display_frame()
+// and the emulated controller RAM has to match the frame buffer.
+//
+// The references were written by this test after the raster kernels had been
+// rewritten, they pin what the driver draws now. That it is what the first
+// commit drew is checked by epaper_golden_baseline: built with
+// EPAPER_GOLDEN_BASELINE, the scenes leave out the filled ellipses and the
+// B/W only device the first commit did not have, they are drawn with its
+// driver (golden_baseline.c) and compared with the current one.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "epaper-29-dke.h"
+#include "epaper_fonts.h"
+#include "epaper_emu.h"
+
+#define DC_PIN      25
+#define BUSY_PIN    35
+
+#define PLANE_SIZE  EPAPER_EMU_RAM_SIZE
+
+static epaper_font_t* s_fonts[] = {
+    &epaper_font_8, &epaper_font_12, &epaper_font_16,
+    &epaper_font_20, &epaper_font_24, &epaper_font_60,
+};
+#define FONT_NUM    ((int) (sizeof(s_fonts) / sizeof(s_fonts[0])))
+
+#ifdef EPAPER_GOLDEN_BASELINE
+#define iot_epaper_draw_filled_ellipse(dev, x, y, x_radius, y_radius, colored)
+#endif
+
+static const char* s_dir;
+static bool s_update;
+static int s_failed;
+static int s_checked;
+
+static epaper_conf_t epaper_conf(bool bw_only)
+{
+    epaper_conf_t conf = {
+        .busy_pin = BUSY_PIN,
+        .cs_pin = 27,
+        .dc_pin = DC_PIN,
+        .miso_pin = -1,
+        .mosi_pin = 13,
+        .reset_pin = 26,
+        .sck_pin = 14,
+
+        .rst_active_level = 0,
+        .busy_active_level = 1,
+
+        .dc_lev_data = 1,
+        .dc_lev_cmd = 0,
+
+        .clk_freq_hz = 20 * 1000 * 1000,
+        .spi_host = HSPI_HOST,
+
+        .width = EPD_WIDTH,
+        .height = EPD_HEIGHT,
+        .color_inv = 1,
+        .fast_bw_mode = bw_only,
+        .bw_only = bw_only,
+    };
+    return conf;
+}
+
+/* the frame as a reference image, a device without red plane shows no red */
+static void frame_to_pbm(epaper_handle_t dev, uint8_t* img)
+{
+    const uint8_t* bw = iot_epaper_get_image(dev);
+    const uint8_t* red = iot_epaper_get_red_image(dev);
+    for (int i = 0; i < PLANE_SIZE; i++) {
+        img[i] = ~bw[i];
+        img[PLANE_SIZE + i] = red ? red[i] : 0;
+    }
+}
+
+static int write_pbm(const char* path, const uint8_t* img)
+{
+    FILE* f = fopen(path, "wb");
+    if (f == NULL) {
+        return -1;
+    }
+    fprintf(f, "P4\n%d %d\n", EPAPER_EMU_RAM_WIDTH, 2 * EPAPER_EMU_RAM_HEIGHT);
+    size_t n = fwrite(img, 1, 2 * PLANE_SIZE, f);
+    fclose(f);
+    return n == 2 * PLANE_SIZE ? 0 : -1;
+}
+
+static int read_pbm(const char* path, uint8_t* img)
+{
+    int w, h;
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        return -1;
+    }
+    if (fscanf(f, "P4 %d %d", &w, &h) != 2 || fgetc(f) == EOF
+            || w != EPAPER_EMU_RAM_WIDTH || h != 2 * EPAPER_EMU_RAM_HEIGHT
+            || fread(img, 1, 2 * PLANE_SIZE, f) != 2 * PLANE_SIZE) {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    return 0;
+}
+
+/* pixels that differ, the first one is reported in panel coordinates */
+static int count_diff(const uint8_t* a, const uint8_t* b, int* first)
+{
+    int n = 0;
+    *first = -1;
+    for (int i = 0; i < 2 * PLANE_SIZE; i++) {
+        uint8_t d = a[i] ^ b[i];
+        if (d && *first < 0) {
+            *first = i * 8 + __builtin_clz((unsigned) d) - 24;
+        }
+        n += __builtin_popcount(d);
+    }
+    return n;
+}
+
+static void check(epaper_handle_t dev, const char* name)
+{
+    static uint8_t img[2 * PLANE_SIZE], ref[2 * PLANE_SIZE];
+    char path[512];
+    int first;
+
+    s_checked++;
+    frame_to_pbm(dev, img);
+
+    // the same frame through the SPI path into the emulated controller
+    iot_epaper_display_frame(dev);
+    if (memcmp(epaper_emu_ram(EPAPER_EMU_RAM_BW), iot_epaper_get_image(dev), PLANE_SIZE) != 0
+            || (iot_epaper_get_red_image(dev)
+                && memcmp(epaper_emu_ram(EPAPER_EMU_RAM_RED), iot_epaper_get_red_image(dev), PLANE_SIZE) != 0)) {
+        printf("FAIL %s: controller RAM differs from the frame buffer\n", name);
+        s_failed++;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s.pbm", s_dir, name);
+    if (s_update) {
+        if (write_pbm(path, img) != 0) {
+            printf("FAIL %s: cannot write %s\n", name, path);
+            s_failed++;
+        }
+        return;
+    }
+    if (read_pbm(path, ref) != 0) {
+        printf("FAIL %s: cannot read %s\n", name, path);
+        s_failed++;
+        return;
+    }
+    int n = count_diff(img, ref, &first);
+    if (n) {
+        int y = first / EPAPER_EMU_RAM_WIDTH;
+        printf("FAIL %s: %d pixels differ, first at x=%d y=%d in the %s plane\n", name, n,
+               first % EPAPER_EMU_RAM_WIDTH, y % EPAPER_EMU_RAM_HEIGHT,
+               y < EPAPER_EMU_RAM_HEIGHT ? "B/W" : "red");
+        snprintf(path, sizeof(path), "%s.actual.pbm", name);
+        write_pbm(path, img);
+        s_failed++;
+    }
+}
+
+/* apps/base-full-refresh */
+static void scene_demo(epaper_handle_t dev)
+{
+    iot_epaper_clean_paint(dev, WHITE);
+    iot_epaper_draw_string(dev, 75, 10, "EPAPER DEMO", &epaper_font_20, RED);
+    iot_epaper_draw_string(dev, 40, 35, "DEPG0290RHS75BF6CP-H0", &epaper_font_16, BLACK);
+    iot_epaper_draw_line(dev, 10, 55, 150, 70, BLACK);
+    iot_epaper_draw_filled_rectangle(dev, 160, 55, 280, 70, RED);
+    iot_epaper_draw_filled_circle(dev, 80, 100, 50, BLACK);
+    iot_epaper_draw_circle(dev, 200, 100, 20, RED);
+}
+
+/* apps/app-clock, the BWR frame drawn every minute */
+static void scene_clock(epaper_handle_t dev)
+{
+    iot_epaper_clean_paint(dev, WHITE);
+    iot_epaper_draw_string(dev, 10, 5, "SAT, 17 OCT 2026", &epaper_font_24, RED);
+    iot_epaper_draw_string(dev, 0, 40, "12", &epaper_font_60, RED);
+    iot_epaper_draw_string(dev, 75, 25, ":", &epaper_font_60, RED);
+    iot_epaper_draw_string(dev, 100, 40, "34", &epaper_font_60, RED);
+    iot_epaper_draw_string(dev, 175, 25, ":", &epaper_font_60, RED);
+}
+
+/* apps/app-clock, the seconds drawn every second on the fast B/W device */
+static void scene_clock_seconds(epaper_handle_t dev)
+{
+    iot_epaper_clean_paint(dev, WHITE);
+    iot_epaper_draw_string(dev, 200, 40, "56", &epaper_font_60, BLACK);
+}
+
+/* every font, clipped at all four edges */
+static void scene_fonts(epaper_handle_t dev, int c)
+{
+    int y = -5;
+    iot_epaper_clean_paint(dev, c);
+    for (int f = 0; f < FONT_NUM; f++) {
+        iot_epaper_draw_string(dev, -7 + f * 3, y, "Ag0~ }{|#@xyz19", s_fonts[f], (c + f) % 3);
+        y += s_fonts[f]->height;
+    }
+    iot_epaper_draw_string(dev, 250, 100, "WXYZ", &epaper_font_24, (c + 1) % 3);
+    iot_epaper_draw_char(dev, 290, 120, 'Q', &epaper_font_16, (c + 2) % 3);
+}
+
+/* unclipped glyphs at every bit offset within a byte */
+static void scene_glyphs(epaper_handle_t dev, int c)
+{
+    int y = 1;
+    iot_epaper_clean_paint(dev, c);
+    for (int f = 0; f < FONT_NUM; f++) {
+        for (int o = 0; o < 8; o++) {
+            char ch[2] = { (char) ('!' + (f * 13 + o * 7) % 94), 0 };
+            iot_epaper_draw_string(dev, 1 + o * (s_fonts[f]->width + 2), y + (o % 2), ch, s_fonts[f], (c + o) % 3);
+        }
+        y += s_fonts[f]->height / 2 + 1;
+    }
+}
+
+/* lines, rectangles, circles and pixels, partly off the panel */
+static void scene_geometry(epaper_handle_t dev, int c)
+{
+    iot_epaper_clean_paint(dev, c);
+    iot_epaper_draw_filled_circle(dev, 150, 64, 90, (c + 1) % 3);
+    for (int i = 0; i < 12; i++) {
+        int col = (c + i) % 3;
+        iot_epaper_draw_line(dev, -10 + i * 7, -3 + i * 5, 300 - i * 11, 130 - i * 9, col);
+        iot_epaper_draw_horizontal_line(dev, -4 + i * 13, i * 11 - 3, i * 9 + 1, col);
+        iot_epaper_draw_vertical_line(dev, i * 25 - 2, i * 3 - 10, i * 12 + 5, col);
+        iot_epaper_draw_rectangle(dev, i * 20 - 5, i * 9 - 4, i * 23 + 11, i * 7 + 20, col);
+        iot_epaper_draw_filled_rectangle(dev, i * 24 + 3, 140 - i * 13, i * 24 + 3 + i, 130 - i * 7, (col + 1) % 3);
+        iot_epaper_draw_circle(dev, i * 27, 64 + (i % 3) * 30, i * 4 + 1, col);
+        iot_epaper_draw_filled_circle(dev, 300 - i * 25, 20 + (i % 4) * 30, i * 3, (col + 2) % 3);
+        iot_epaper_draw_filled_ellipse(dev, 40 + i * 20, 110 - i * 6, i * 3 + 2, i + 1, (col + 1) % 3);
+        iot_epaper_draw_pixel(dev, i * 30, i * 11, col);
+        iot_epaper_draw_pixel(dev, -1, i, col);
+        iot_epaper_draw_pixel(dev, i, 0, col);
+        iot_epaper_draw_pixel(dev, 127, i, col);
+        iot_epaper_draw_pixel(dev, 295, i, col);
+    }
+    iot_epaper_draw_filled_rectangle(dev, 0, 0, 400, 3, (c + 1) % 3);
+    iot_epaper_draw_filled_rectangle(dev, 100, 140, -10, 120, (c + 2) % 3);
+    iot_epaper_draw_filled_circle(dev, 0, 0, 0, (c + 1) % 3);
+    iot_epaper_draw_filled_circle(dev, 150, 64, 1, c);
+}
+
+int main(int argc, char** argv)
+{
+    char name[64];
+    epaper_emu_config_t emu_conf = {
+        .dc_pin = DC_PIN,
+        .busy_pin = BUSY_PIN,
+        .busy_active_level = 1,
+        .dc_lev_cmd = 0,
+        .refresh_us = 0,
+    };
+    epaper_conf_t conf;
+    epaper_handle_t dev;
+
+    if (argc > 1 && strcmp(argv[1], "--update") == 0) {
+        s_update = true;
+        argc--;
+        argv++;
+    }
+    if (argc != 2) {
+        fprintf(stderr, "usage: epaper_golden [--update] <golden dir>\n");
+        return 2;
+    }
+    s_dir = argv[1];
+
+    epaper_emu_config(&emu_conf);
+    epaper_emu_reset();
+    conf = epaper_conf(false);
+    dev = iot_epaper_create(NULL, &conf);
+    if (dev == NULL) {
+        fprintf(stderr, "iot_epaper_create failed\n");
+        return 1;
+    }
+    for (int rot = 0; rot < 4; rot++) {
+        // a different background per rotation, every colour gets covered
+        int bg = (rot + 1) % 3;
+        iot_epaper_set_rotate(dev, rot);
+        scene_demo(dev);
+        snprintf(name, sizeof(name), "demo_r%d", rot);
+        check(dev, name);
+        scene_fonts(dev, bg);
+        snprintf(name, sizeof(name), "fonts_r%d", rot);
+        check(dev, name);
+        scene_glyphs(dev, bg);
+        snprintf(name, sizeof(name), "glyphs_r%d", rot);
+        check(dev, name);
+        scene_geometry(dev, bg);
+        snprintf(name, sizeof(name), "geometry_r%d", rot);
+        check(dev, name);
+    }
+    iot_epaper_set_rotate(dev, E_PAPER_ROTATE_90);
+    scene_clock(dev);
+    check(dev, "clock_r1");
+    iot_epaper_delete(dev, true);
+
+#ifndef EPAPER_GOLDEN_BASELINE
+    // the single plane path of a device without red plane
+    epaper_emu_reset();
+    conf = epaper_conf(true);
+    dev = iot_epaper_create(NULL, &conf);
+    if (dev == NULL) {
+        fprintf(stderr, "iot_epaper_create failed\n");
+        return 1;
+    }
+    iot_epaper_set_rotate(dev, E_PAPER_ROTATE_90);
+    scene_clock_seconds(dev);
+    check(dev, "clock_seconds_r1");
+    scene_geometry(dev, WHITE);
+    check(dev, "geometry_bw_r1");
+    iot_epaper_delete(dev, true);
+#endif
+
+    if (s_update) {
+        printf("%d golden images written to %s\n", s_checked, s_dir);
+    } else {
+        printf("%d/%d scenes match\n", s_checked - s_failed, s_checked);
+    }
+    return s_failed ? 1 : 0;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "driver/gpio.h"
+#include "freertos/FreeRTOS.h"
+typedef enum { SPI1_HOST = 0, SPI2_HOST = 1, SPI3_HOST = 2 } spi_host_device_t;
+#define HSPI_HOST SPI2_HOST
+#define VSPI_HOST SPI3_HOST
+#define SPI_DEVICE_3WIRE      (1<<2)
+#define SPI_DEVICE_HALFDUPLEX (1<<4)
+#define SPI_TRANS_USE_TXDATA  (1<<3)
+typedef struct spi_transaction_t spi_transaction_t;
+typedef void (*transaction_cb_t)(spi_transaction_t *trans);
+struct spi_transaction_t {
+    uint32_t flags;
+    uint16_t cmd;
+    uint64_t addr;
+    size_t length;
+    size_t rxlength;
+    void *user;
+    union { const void *tx_buffer; uint8_t tx_data[4]; };
+    union { void *rx_buffer; uint8_t rx_data[4]; };
+};
+typedef struct {
+    int mosi_io_num, miso_io_num, sclk_io_num, quadwp_io_num, quadhd_io_num;
+    int max_transfer_sz;
+    uint32_t flags;
+    int intr_flags;
+} spi_bus_config_t;
+typedef struct {
+    uint8_t command_bits, address_bits, dummy_bits, mode;
+    uint16_t duty_cycle_pos, cs_ena_pretrans;
+    uint8_t cs_ena_posttrans;
+    int clock_speed_hz;
+    int input_delay_ns;
+    int spics_io_num;
+    uint32_t flags;
+    int queue_size;
+    transaction_cb_t pre_cb;
+    transaction_cb_t post_cb;
+} spi_device_interface_config_t;
+typedef struct spi_device_t *spi_device_handle_t;
+esp_err_t spi_bus_initialize(spi_host_device_t host, const spi_bus_config_t *cfg, int dma_chan);
+esp_err_t spi_bus_free(spi_host_device_t host);
+esp_err_t spi_bus_add_device(spi_host_device_t host, const spi_device_interface_config_t *cfg, spi_device_handle_t *handle);
+esp_err_t spi_bus_remove_device(spi_device_handle_t handle);
+esp_err_t spi_device_transmit(spi_device_handle_t handle, spi_transaction_t *t);
+esp_err_t spi_device_polling_transmit(spi_device_handle_t handle, spi_transaction_t *t);
+esp_err_t spi_device_queue_trans(spi_device_handle_t handle, spi_transaction_t *t, TickType_t ticks);
+esp_err_t spi_device_get_trans_result(spi_device_handle_t handle, spi_transaction_t **t, TickType_t ticks);
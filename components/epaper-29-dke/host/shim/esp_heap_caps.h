@@ -0,0 +1,9 @@
+#pragma once
+#include <stdlib.h>
+#define MALLOC_CAP_8BIT (1<<2)
+#define MALLOC_CAP_DMA  (1<<3)
+#define MALLOC_CAP_32BIT (1<<1)
+#define MALLOC_CAP_INTERNAL (1<<11)
+static inline void *heap_caps_malloc(size_t s, unsigned caps) { (void)caps; return malloc(s); }
+static inline void *heap_caps_calloc(size_t n, size_t s, unsigned caps) { (void)caps; return calloc(n, s); }
+static inline void heap_caps_free(void *p) { free(p); }
@@ -0,0 +1,30 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+#define configTICK_RATE_HZ 100
+#define portTICK_PERIOD_MS ((TickType_t)1000 / configTICK_RATE_HZ)
+#define portTICK_RATE_MS portTICK_PERIOD_MS
+#define pdMS_TO_TICKS(ms) ((TickType_t)(((TickType_t)(ms) * (TickType_t)configTICK_RATE_HZ) / (TickType_t)1000))
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define IRAM_ATTR
+#define portYIELD_FROM_ISR() do { } while (0)
+#define tskNO_AFFINITY 0x7FFFFFFF
+typedef struct { int owner; int count; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED { 0, 0 }
+void shim_enter_critical(portMUX_TYPE *mux);
+void shim_exit_critical(portMUX_TYPE *mux);
+#define portENTER_CRITICAL(mux) shim_enter_critical(mux)
+#define portEXIT_CRITICAL(mux)  shim_exit_critical(mux)
+#define portENTER_CRITICAL_ISR(mux) shim_enter_critical(mux)
+#define portEXIT_CRITICAL_ISR(mux)  shim_exit_critical(mux)
+void ets_delay_us(uint32_t us);
@@ -0,0 +1,2 @@
+#pragma once
+/* included by the component, nothing of it is used */
@@ -0,0 +1,311 @@
+// FreeRTOS on pthreads for the host build: semaphores, queues, tasks and
+// notifications, enough for the epaper-29-dke component. Ticks are 10 ms.
+// ets_delay_us() only sleeps when EMU_REAL_DELAY is set in the environment.
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+static pthread_mutex_t s_critical = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+void shim_enter_critical(portMUX_TYPE *mux) { (void)mux; pthread_mutex_lock(&s_critical); }
+void shim_exit_critical(portMUX_TYPE *mux) { (void)mux; pthread_mutex_unlock(&s_critical); }
+
+void ets_delay_us(uint32_t us) { if (getenv("EMU_REAL_DELAY")) usleep(us); }
+
+static void deadline(struct timespec *ts, TickType_t ticks)
+{
+    clock_gettime(CLOCK_REALTIME, ts);
+    uint64_t ns = (uint64_t)ticks * portTICK_PERIOD_MS * 1000000ULL;
+    ts->tv_sec += ns / 1000000000ULL;
+    ts->tv_nsec += ns % 1000000000ULL;
+    if (ts->tv_nsec >= 1000000000L) { ts->tv_sec++; ts->tv_nsec -= 1000000000L; }
+}
+
+/* Generic blocking wait on cond until pred() or timeout */
+#define WAIT_UNTIL(cond_var, mtx, pred, ticks, ok) do { \
+        struct timespec _ts; if ((ticks) != portMAX_DELAY) deadline(&_ts, (ticks)); \
+        (ok) = 1; \
+        while (!(pred)) { \
+            if ((ticks) == 0) { (ok) = 0; break; } \
+            if ((ticks) == portMAX_DELAY) pthread_cond_wait(&(cond_var), &(mtx)); \
+            else if (pthread_cond_timedwait(&(cond_var), &(mtx), &_ts) == ETIMEDOUT && !(pred)) { (ok) = 0; break; } \
+        } } while (0)
+
+struct shim_sem {
+    pthread_mutex_t m;
+    pthread_cond_t c;
+    int count, max;
+    int recursive, mutex;
+    pthread_t owner;
+    int depth;
+};
+
+static SemaphoreHandle_t sem_new(int max, int initial)
+{
+    struct shim_sem *s = calloc(1, sizeof(*s));
+    pthread_mutex_init(&s->m, NULL);
+    pthread_cond_init(&s->c, NULL);
+    s->max = max;
+    s->count = initial;
+    return s;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) { return sem_new(1, 0); }
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial) { return sem_new(max, initial); }
+SemaphoreHandle_t xSemaphoreCreateMutex(void) { SemaphoreHandle_t s = sem_new(1, 1); s->mutex = 1; return s; }
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void) { SemaphoreHandle_t s = sem_new(1, 1); s->recursive = 1; return s; }
+
+void vSemaphoreDelete(SemaphoreHandle_t s)
+{
+    pthread_mutex_destroy(&s->m);
+    pthread_cond_destroy(&s->c);
+    free(s);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t ticks)
+{
+    int ok;
+    pthread_mutex_lock(&s->m);
+    WAIT_UNTIL(s->c, s->m, s->count > 0, ticks, ok);
+    if (ok) {
+        s->count--;
+        s->owner = pthread_self();
+    }
+    pthread_mutex_unlock(&s->m);
+    return ok ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t s)
+{
+    int ok = 0;
+    pthread_mutex_lock(&s->m);
+    if (s->count < s->max) {
+        s->count++;
+        ok = 1;
+        pthread_cond_broadcast(&s->c);
+    }
+    pthread_mutex_unlock(&s->m);
+    return ok ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t s, BaseType_t *woken)
+{
+    if (woken) {
+        *woken = pdFALSE;
+    }
+    return xSemaphoreGive(s);
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t s, TickType_t ticks)
+{
+    int ok;
+    pthread_mutex_lock(&s->m);
+    if (s->depth > 0 && pthread_equal(s->owner, pthread_self())) {
+        s->depth++;
+        pthread_mutex_unlock(&s->m);
+        return pdTRUE;
+    }
+    WAIT_UNTIL(s->c, s->m, s->depth == 0, ticks, ok);
+    if (ok) {
+        s->depth = 1;
+        s->owner = pthread_self();
+    }
+    pthread_mutex_unlock(&s->m);
+    return ok ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t s)
+{
+    pthread_mutex_lock(&s->m);
+    if (s->depth == 0 || !pthread_equal(s->owner, pthread_self())) {
+        pthread_mutex_unlock(&s->m);
+        return pdFALSE;
+    }
+    if (--s->depth == 0) {
+        pthread_cond_broadcast(&s->c);
+    }
+    pthread_mutex_unlock(&s->m);
+    return pdTRUE;
+}
+
+struct shim_task {
+    pthread_t thread;
+    TaskFunction_t fn;
+    void *arg;
+    SemaphoreHandle_t notify;
+};
+
+static __thread struct shim_task *s_current;
+static struct shim_task s_main_task;
+
+static void *task_entry(void *p)
+{
+    struct shim_task *t = p;
+    s_current = t;
+    t->fn(t->arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack, void *arg, UBaseType_t prio, TaskHandle_t *handle)
+{
+    (void)name; (void)stack; (void)prio;
+    struct shim_task *t = calloc(1, sizeof(*t));
+    t->fn = fn;
+    t->arg = arg;
+    t->notify = xSemaphoreCreateCounting(0x7fffffff, 0);
+    if (handle) {
+        *handle = t;
+    }
+    if (pthread_create(&t->thread, NULL, task_entry, t) != 0) {
+        return pdFAIL;
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack, void *arg, UBaseType_t prio, TaskHandle_t *handle, BaseType_t core)
+{
+    (void)core;
+    return xTaskCreate(fn, name, stack, arg, prio, handle);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task == NULL || task == s_current) {
+        pthread_detach(pthread_self());
+        pthread_exit(NULL);
+    }
+    /* a deleted FreeRTOS task never runs again, wait for the cancel to land */
+    pthread_cancel(task->thread);
+    pthread_join(task->thread, NULL);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    usleep((useconds_t)ticks * portTICK_PERIOD_MS * 1000);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (TickType_t)(ts.tv_sec * configTICK_RATE_HZ + ts.tv_nsec / (1000000000L / configTICK_RATE_HZ));
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task)
+{
+    (void)task;
+    return 5;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    if (s_current == NULL) {
+        s_main_task.thread = pthread_self();
+        s_main_task.notify = xSemaphoreCreateCounting(0x7fffffff, 0);
+        s_current = &s_main_task;
+    }
+    return s_current;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    return xSemaphoreGive(task->notify);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+    uint32_t n = 0;
+    if (xSemaphoreTake(self->notify, ticks) != pdTRUE) {
+        return 0;
+    }
+    n = 1;
+    if (clear) {
+        while (xSemaphoreTake(self->notify, 0) == pdTRUE) {
+            n++;
+        }
+    }
+    return n;
+}
+
+struct shim_queue {
+    pthread_mutex_t m;
+    pthread_cond_t c;
+    uint8_t *buf;
+    UBaseType_t len, size, head, count;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    struct shim_queue *q = calloc(1, sizeof(*q));
+    pthread_mutex_init(&q->m, NULL);
+    pthread_cond_init(&q->c, NULL);
+    q->buf = calloc(length, item_size);
+    q->len = length;
+    q->size = item_size;
+    return q;
+}
+
+void vQueueDelete(QueueHandle_t q)
+{
+    free(q->buf);
+    pthread_mutex_destroy(&q->m);
+    pthread_cond_destroy(&q->c);
+    free(q);
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks)
+{
+    int ok;
+    pthread_mutex_lock(&q->m);
+    WAIT_UNTIL(q->c, q->m, q->count < q->len, ticks, ok);
+    if (ok) {
+        memcpy(q->buf + ((q->head + q->count) % q->len) * q->size, item, q->size);
+        q->count++;
+        pthread_cond_broadcast(&q->c);
+    }
+    pthread_mutex_unlock(&q->m);
+    return ok ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xQueueOverwrite(QueueHandle_t q, const void *item)
+{
+    pthread_mutex_lock(&q->m);
+    memcpy(q->buf + q->head * q->size, item, q->size);
+    q->count = 1;
+    pthread_cond_broadcast(&q->c);
+    pthread_mutex_unlock(&q->m);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks)
+{
+    int ok;
+    pthread_mutex_lock(&q->m);
+    WAIT_UNTIL(q->c, q->m, q->count > 0, ticks, ok);
+    if (ok) {
+        memcpy(item, q->buf + q->head * q->size, q->size);
+        q->head = (q->head + 1) % q->len;
+        q->count--;
+        pthread_cond_broadcast(&q->c);
+    }
+    pthread_mutex_unlock(&q->m);
+    return ok ? pdTRUE : pdFALSE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q)
+{
+    pthread_mutex_lock(&q->m);
+    UBaseType_t n = q->count;
+    pthread_mutex_unlock(&q->m);
+    return n;
+}
@@ -0,0 +1,219 @@
+// Replays an SPI trace written by iot_epaper_trace_dump() into the emulated
+// controller and summarises it per frame. A frame ends with the transaction
+// that starts the refresh (master activation, 0x20).
+//
+//   epaper_replay <trace> [out dir]
+//
+// The trace is the binary dump, or a console log with the EPTRACE: lines of a
+// hex dump in it. With an out dir the panel RAM after the replay is written
+// there as replay.ppm.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "epaper-29-dke.h"
+#include "epaper_emu.h"
+
+typedef struct {
+    uint32_t trans;
+    uint32_t bytes;
+    uint32_t cmd_bytes;
+    uint32_t ram_bytes;     /* written to the B/W or red RAM */
+    uint32_t spi_us;        /* sum of the transfer durations */
+    uint32_t span_us;       /* first transfer start to last transfer end */
+    uint32_t max_gap_us;
+    uint32_t first_us;
+    uint32_t end_us;
+    int lut;                /* a waveform was uploaded */
+} frame_t;
+
+static uint8_t* read_file(const char* path, size_t* size)
+{
+    FILE* f = fopen(path, "rb");
+    uint8_t* buf = NULL;
+    size_t n = 0, cap = 0;
+    if (f == NULL) {
+        return NULL;
+    }
+    for (;;) {
+        if (n == cap) {
+            cap = cap ? cap * 2 : 65536;
+            buf = realloc(buf, cap);
+        }
+        size_t r = fread(buf + n, 1, cap - n, f);
+        if (r == 0) {
+            break;
+        }
+        n += r;
+    }
+    fclose(f);
+    *size = n;
+    return buf;
+}
+
+static int hex_digit(int c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/* the bytes of all EPTRACE: lines of a console log, in place */
+static size_t decode_hex(uint8_t* buf, size_t size)
+{
+    size_t out = 0;
+    char* p = (char*) buf;
+    char* end = (char*) buf + size;
+    while (p < end) {
+        char* eol = memchr(p, '\n', end - p);
+        eol = eol ? eol : end;
+        char* tag = NULL;
+        for (char* q = p; q + 8 <= eol; q++) {
+            if (memcmp(q, "EPTRACE:", 8) == 0) {
+                tag = q + 8;
+                break;
+            }
+        }
+        while (tag && tag + 1 < eol && hex_digit(tag[0]) >= 0 && hex_digit(tag[1]) >= 0) {
+            buf[out++] = (uint8_t) (hex_digit(tag[0]) << 4 | hex_digit(tag[1]));
+            tag += 2;
+        }
+        p = eol + 1;
+    }
+    return out;
+}
+
+static void print_frame(int index, const frame_t* f, long wait_us)
+{
+    printf("%5d %6u %7u %5u %7u %8u %8u %8u %8u",
+           index, f->trans, f->bytes, f->cmd_bytes, f->ram_bytes,
+           f->span_us, f->spi_us, f->span_us - f->spi_us, f->max_gap_us);
+    if (wait_us >= 0) {
+        printf(" %9ld", wait_us);
+    } else {
+        printf(" %9s", "-");
+    }
+    printf("%s\n", f->lut ? "  lut" : "");
+}
+
+int main(int argc, char** argv)
+{
+    epaper_trace_header_t header;
+    epaper_trace_record_t rec;
+    frame_t frame, total;
+    size_t size, pos;
+    uint8_t* buf;
+    uint8_t last_cmd = 0;
+    uint32_t truncated = 0, records = 0;
+    int frames = 0;
+    char path[512];
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: epaper_replay <trace> [out dir]\n");
+        return 2;
+    }
+    buf = read_file(argv[1], &size);
+    if (buf == NULL) {
+        fprintf(stderr, "cannot read %s\n", argv[1]);
+        return 1;
+    }
+    if (size < sizeof(header) || memcmp(buf, "EPTR", 4) != 0) {
+        size = decode_hex(buf, size);
+    }
+    if (size < sizeof(header)) {
+        fprintf(stderr, "%s: no trace found\n", argv[1]);
+        return 1;
+    }
+    memcpy(&header, buf, sizeof(header));
+    if (header.magic != E_PAPER_TRACE_MAGIC || header.version != E_PAPER_TRACE_VERSION
+            || header.record_size != sizeof(epaper_trace_record_t)) {
+        fprintf(stderr, "%s: not a version %d trace\n", argv[1], E_PAPER_TRACE_VERSION);
+        return 1;
+    }
+    printf("%u records, %u dropped%s\n", header.records, header.dropped,
+           header.dropped ? ", the first frame may be incomplete" : "");
+
+    epaper_emu_reset();
+    memset(&frame, 0, sizeof(frame));
+    memset(&total, 0, sizeof(total));
+    printf("%5s %6s %7s %5s %7s %8s %8s %8s %8s %9s\n",
+           "frame", "trans", "bytes", "cmd", "ram", "span_us", "spi_us", "idle_us", "max_gap", "refresh");
+    for (pos = sizeof(header); pos + sizeof(rec) <= size; pos += sizeof(rec) + rec.captured) {
+        memcpy(&rec, buf + pos, sizeof(rec));
+        if (pos + sizeof(rec) + rec.captured > size) {
+            fprintf(stderr, "trace cut short after %u records\n", records);
+            break;
+        }
+        const uint8_t* data = buf + pos + sizeof(rec);
+        int is_cmd = rec.flags & E_PAPER_TRACE_COMMAND;
+        records++;
+        truncated += (rec.flags & E_PAPER_TRACE_TRUNCATED) ? 1 : 0;
+        epaper_emu_write(is_cmd, data, rec.captured);
+
+        if (frame.trans == 0) {
+            frame.first_us = rec.start_us;
+        } else {
+            uint32_t gap = rec.start_us - frame.end_us;
+            frame.max_gap_us = gap > frame.max_gap_us ? gap : frame.max_gap_us;
+        }
+        frame.trans++;
+        frame.bytes += rec.length;
+        frame.spi_us += rec.duration_us;
+        frame.end_us = rec.start_us + rec.duration_us;
+        frame.span_us = frame.end_us - frame.first_us;
+        if (is_cmd) {
+            frame.cmd_bytes += rec.length;
+            last_cmd = rec.captured ? data[rec.captured - 1] : last_cmd;
+            frame.lut |= last_cmd == E_PAPER_WRITE_LUT_REGISTER;
+        } else if (last_cmd == E_PAPER_WRITE_RAM || last_cmd == 0x26 /* red RAM */) {
+            frame.ram_bytes += rec.length;
+        }
+
+        if (is_cmd && last_cmd == E_PAPER_MASTER_ACTIVATION) {
+            // the refresh time shows as the gap to the next record
+            long wait_us = -1;
+            if (pos + sizeof(rec) + rec.captured + sizeof(rec) <= size) {
+                epaper_trace_record_t next;
+                memcpy(&next, buf + pos + sizeof(rec) + rec.captured, sizeof(next));
+                wait_us = (long) (uint32_t) (next.start_us - frame.end_us);
+            }
+            print_frame(frames++, &frame, wait_us);
+            total.trans += frame.trans;
+            total.bytes += frame.bytes;
+            total.cmd_bytes += frame.cmd_bytes;
+            total.ram_bytes += frame.ram_bytes;
+            total.spi_us += frame.spi_us;
+            total.span_us += frame.span_us;
+            total.max_gap_us = frame.max_gap_us > total.max_gap_us ? frame.max_gap_us : total.max_gap_us;
+            memset(&frame, 0, sizeof(frame));
+        }
+    }
+    if (frame.trans) {
+        printf("after the last refresh:\n");
+        print_frame(frames, &frame, -1);
+    }
+    if (frames) {
+        printf("%d frames, %u transactions and %u bytes, %u us on the bus in %u us\n",
+               frames, total.trans, total.bytes, total.spi_us, total.span_us);
+    }
+    if (truncated) {
+        printf("%u records were not captured in full, the replayed RAM is incomplete\n", truncated);
+    }
+    if (argc > 2) {
+        snprintf(path, sizeof(path), "%s/replay.ppm", argv[2]);
+        if (epaper_emu_write_ppm(path) != 0) {
+            fprintf(stderr, "cannot write %s\n", path);
+            return 1;
+        }
+        printf("panel RAM written to %s\n", path);
+    }
+    free(buf);
+    return records == header.records ? 0 : 1;
+}
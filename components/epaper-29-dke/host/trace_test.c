@@ -0,0 +1,78 @@
+// Deletes devices while the SPI trace is recording. iot_epaper_delete()
+// still sends the sleep command, which must not land in a freed trace buffer.
+// Built with AddressSanitizer where the compiler has it, see CMakeLists.txt.
+
+#include <stdio.h>
+#include "epaper-29-dke.h"
+#include "epaper_fonts.h"
+#include "epaper_emu.h"
+
+#define DC_PIN      25
+#define BUSY_PIN    35
+
+static epaper_handle_t create(void)
+{
+    epaper_conf_t conf = {
+        .busy_pin = BUSY_PIN,
+        .cs_pin = 27,
+        .dc_pin = DC_PIN,
+        .miso_pin = -1,
+        .mosi_pin = 13,
+        .reset_pin = 26,
+        .sck_pin = 14,
+
+        .rst_active_level = 0,
+        .busy_active_level = 1,
+
+        .dc_lev_data = 1,
+        .dc_lev_cmd = 0,
+
+        .clk_freq_hz = 20 * 1000 * 1000,
+        .spi_host = HSPI_HOST,
+
+        .width = EPD_WIDTH,
+        .height = EPD_HEIGHT,
+        .color_inv = 1,
+        .fast_bw_mode = false,
+    };
+    epaper_emu_reset();
+    return iot_epaper_create(NULL, &conf);
+}
+
+int main(void)
+{
+    epaper_emu_config_t emu_conf = {
+        .dc_pin = DC_PIN,
+        .busy_pin = BUSY_PIN,
+        .busy_active_level = 1,
+        .dc_lev_cmd = 0,
+        .refresh_us = 0,
+    };
+    epaper_handle_t device;
+
+    epaper_emu_config(&emu_conf);
+
+    // recording when the device goes
+    device = create();
+    if (device == NULL || iot_epaper_trace_start(device) != ESP_OK) {
+        fprintf(stderr, "cannot start the trace\n");
+        return 1;
+    }
+    iot_epaper_draw_string(device, 10, 10, "TRACE", &epaper_font_24, BLACK);
+    iot_epaper_display_frame(device);
+    iot_epaper_delete(device, true);
+
+    // a trace started, stopped and restarted
+    device = create();
+    if (device == NULL || iot_epaper_trace_start(device) != ESP_OK
+            || iot_epaper_trace_stop(device) != ESP_OK
+            || iot_epaper_trace_start(device) != ESP_OK) {
+        fprintf(stderr, "cannot restart the trace\n");
+        return 1;
+    }
+    iot_epaper_display_frame(device);
+    iot_epaper_delete(device, true);
+
+    printf("devices deleted while tracing\n");
+    return 0;
+}
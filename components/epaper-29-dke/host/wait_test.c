@@ -0,0 +1,87 @@
+// Waits for the panel from the application while a frame sent by
+// iot_epaper_display_frame_async() is in flight. Both waits must end with the
+// refresh, one busy pin edge wakes one waiter only. Which task gets the edge
+// varies, so a few frames are sent.
+
+#include <stdio.h>
+#include "epaper-29-dke.h"
+#include "epaper_emu.h"
+#include "esp_timer.h"
+
+#define DC_PIN      25
+#define BUSY_PIN    35
+#define REFRESH_US  100000
+#define FRAMES      8
+
+static int64_t s_start_us;
+static volatile int64_t s_done_us;
+
+static void frame_done(epaper_handle_t dev, void* arg)
+{
+    (void) dev;
+    (void) arg;
+    s_done_us = esp_timer_get_time() - s_start_us;
+}
+
+int main(void)
+{
+    epaper_emu_config_t emu_conf = {
+        .dc_pin = DC_PIN,
+        .busy_pin = BUSY_PIN,
+        .busy_active_level = 1,
+        .dc_lev_cmd = 0,
+        .refresh_us = REFRESH_US,
+    };
+    epaper_conf_t conf = {
+        .busy_pin = BUSY_PIN,
+        .cs_pin = 27,
+        .dc_pin = DC_PIN,
+        .miso_pin = -1,
+        .mosi_pin = 13,
+        .reset_pin = 26,
+        .sck_pin = 14,
+
+        .rst_active_level = 0,
+        .busy_active_level = 1,
+
+        .dc_lev_data = 1,
+        .dc_lev_cmd = 0,
+
+        .clk_freq_hz = 20 * 1000 * 1000,
+        .spi_host = HSPI_HOST,
+
+        .width = EPD_WIDTH,
+        .height = EPD_HEIGHT,
+        .color_inv = 1,
+        .fast_bw_mode = false,
+    };
+    epaper_busy_stats_t refresh;
+    epaper_handle_t device;
+    int64_t idle_us;
+    int fails = 0;
+
+    epaper_emu_config(&emu_conf);
+    device = iot_epaper_create(NULL, &conf);
+    if (device == NULL) {
+        fprintf(stderr, "iot_epaper_create failed\n");
+        return 1;
+    }
+    for (int i = 0; i < FRAMES && !fails; i++) {
+        s_start_us = esp_timer_get_time();
+        iot_epaper_display_frame_async(device, frame_done, NULL);
+        iot_epaper_wait_idle(device);
+        idle_us = esp_timer_get_time() - s_start_us;
+        iot_epaper_wait_frame_done(device, portMAX_DELAY);
+        iot_epaper_get_busy_stats(device, E_PAPER_BUSY_REFRESH, &refresh);
+
+        printf("frame %d: idle after %lld ms, done after %lld ms, refresh %u ms\n", i,
+               (long long) idle_us / 1000, (long long) s_done_us / 1000, (unsigned) refresh.last_us / 1000);
+        // a missed edge shows as a wait of EPAPER_BUSY_TIMEOUT_MS
+        if (idle_us > 10 * REFRESH_US || s_done_us > 10 * REFRESH_US || refresh.last_us > 10 * REFRESH_US) {
+            fprintf(stderr, "a waiter missed the end of the refresh\n");
+            fails++;
+        }
+    }
+    iot_epaper_delete(device, true);
+    return fails;
+}